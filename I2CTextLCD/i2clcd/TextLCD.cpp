@@ -52,8 +52,17 @@
 #include "mbed.h"
 
 
-TextLCD::TextLCD(PinName sda, PinName scl, int i2cAddress, LCDType type) : _i2c(sda, scl), _i2cAddress(i2cAddress) , _type(type){
+TextLCD::TextLCD(PinName sda, PinName scl, int i2cAddress, LCDType type) : _i2c(sda, scl), _i2cAddress(i2cAddress) , _type(type),
+        _column(0), _row(0), _ready(false) {
    // _i2cAddress = i2cAddress;
+}
+
+void TextLCD::init() {
+    if (_ready) {
+        return;
+    }
+    _ready = true;
+
     writeByte(E_ON,false);
     wait_us(15000);        // Wait 15ms to ensure powered up
 
@@ -72,17 +81,23 @@ TextLCD::TextLCD(PinName sda, PinName scl, int i2cAddress, LCDType type) : _i2c(
 }
 
 void TextLCD::character(int column, int row, int c) {
+    init();
     int a = address(column, row);
     writeCommand(a);
     writeData(c);
 }
 
 void TextLCD::cls() {
+    init();
     writeCommand(0x01); // cls, and set cursor to 0
     wait_us(1700);     // This command takes 1.64 ms
     locate(0, 0);
 }
 
+void TextLCD::frequency(int hz) {
+    _i2c.frequency(hz);
+}
+
 void TextLCD::locate(int column, int row) {
     _column = column;
     _row = row;
@@ -60,6 +60,9 @@ public:
     };
 
     /** Create a TextLCD interface
+     *
+     * The panel is not touched here, it is initialised by init() or on the
+     * first write, so a global TextLCD costs nothing at boot.
      *
      * @param rs    Instruction/data control line
      * @param e     Enable line (clock)
@@ -93,6 +96,15 @@ public:
     /** Clear the screen and locate to 0,0 */
     void cls();
 
+    /** Initialise the panel (some 40ms of waits), repeated calls do nothing */
+    void init();
+
+    /** Set the I2C bus frequency used by this display
+     *
+     * @param hz  bus speed, the PCF8574 backpack supports up to 100kHz
+     */
+    void frequency(int hz);
+
     int rows();
     int columns();
 
@@ -117,6 +129,7 @@ protected:
 
     int _column;
     int _row;
+    bool _ready;
 };
 
 #endif
@@ -0,0 +1,290 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: adc_scan.cpp
+ *
+ * __Description:__
+ * timer triggered ADC1 scan with circular DMA, see adc_scan.h
+ * - STM32L4: 16x hardware oversampling per conversion + block averaging
+ * - STM32F4: no hardware oversampling, software block averaging only
+ * mbed AnalogIn is not used, it would reconfigure ADC1 for single conversions
+ *******************************************************************************/
+
+#include "adc_scan.h"
+#include "board_traits.h"
+
+#include "pinmap.h"
+#include "PeripheralPins.h"
+
+#define ADC_DMA_LEN (2 * ADC_BLOCK_SCANS * AdcSlotCount)
+
+static const PinName adc_pins[AdcSlotCount] = {
+    Board::MOIST_12V_PIN,
+    Board::MOIST_A_PIN,
+    Board::MOIST_B_PIN,
+    Board::CURRENT_12V_PIN,
+    Board::CURRENT_A_PIN,
+    Board::CURRENT_B_PIN
+};
+
+static ADC_HandleTypeDef adc_handle;
+static DMA_HandleTypeDef adc_dma_handle;
+static TIM_HandleTypeDef adc_tim_handle;
+
+static uint16_t adc_dma_buf[ADC_DMA_LEN];
+
+static uint32_t adc_acc[AdcSlotCount];
+static uint32_t adc_acc_blocks = 0;
+static volatile uint16_t adc_avg[AdcSlotCount];
+static adc_block_handler_t adc_block_handler = NULL;
+
+static void adc_dma_irq_handler(void);
+static int adc_timer_init(void);
+
+#if defined(TARGET_STM32L4)
+
+static const uint32_t adc_ranks[] = {
+    ADC_REGULAR_RANK_1, ADC_REGULAR_RANK_2, ADC_REGULAR_RANK_3, ADC_REGULAR_RANK_4,
+    ADC_REGULAR_RANK_5, ADC_REGULAR_RANK_6, ADC_REGULAR_RANK_7, ADC_REGULAR_RANK_8
+};
+MBED_STATIC_ASSERT(AdcSlotCount <= (sizeof(adc_ranks) / sizeof(adc_ranks[0])), "extend adc_ranks");
+
+static int adc_hw_init(void) {
+    __HAL_RCC_ADC_CLK_ENABLE();
+    __HAL_RCC_ADC_CONFIG(RCC_ADCCLKSOURCE_SYSCLK);
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    adc_dma_handle.Instance = DMA1_Channel1;
+    adc_dma_handle.Init.Request = DMA_REQUEST_0;
+    adc_dma_handle.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    adc_dma_handle.Init.PeriphInc = DMA_PINC_DISABLE;
+    adc_dma_handle.Init.MemInc = DMA_MINC_ENABLE;
+    adc_dma_handle.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    adc_dma_handle.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    adc_dma_handle.Init.Mode = DMA_CIRCULAR;
+    adc_dma_handle.Init.Priority = DMA_PRIORITY_MEDIUM;
+    if (HAL_DMA_Init(&adc_dma_handle) != HAL_OK) {
+        return -1;
+    }
+    __HAL_LINKDMA(&adc_handle, DMA_Handle, adc_dma_handle);
+
+    adc_handle.Instance = ADC1;
+    adc_handle.Init.ClockPrescaler = ADC_CLOCK_ASYNC_DIV4;
+    adc_handle.Init.Resolution = ADC_RESOLUTION_12B;
+    adc_handle.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    adc_handle.Init.ScanConvMode = ADC_SCAN_ENABLE;
+    adc_handle.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    adc_handle.Init.LowPowerAutoWait = DISABLE;
+    adc_handle.Init.ContinuousConvMode = DISABLE;
+    adc_handle.Init.NbrOfConversion = AdcSlotCount;
+    adc_handle.Init.DiscontinuousConvMode = DISABLE;
+    adc_handle.Init.ExternalTrigConv = Board::ADC_TRIGGER;
+    adc_handle.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+    adc_handle.Init.DMAContinuousRequests = ENABLE;
+    adc_handle.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+    adc_handle.Init.OversamplingMode = ENABLE;
+    adc_handle.Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_16;
+    adc_handle.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_4;
+    adc_handle.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+    adc_handle.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+    if (HAL_ADC_Init(&adc_handle) != HAL_OK) {
+        return -2;
+    }
+
+    ADC_ChannelConfTypeDef channel = {0};
+    channel.SamplingTime = ADC_SAMPLETIME_47CYCLES_5;
+    channel.SingleDiff = ADC_SINGLE_ENDED;
+    channel.OffsetNumber = ADC_OFFSET_NONE;
+    channel.Offset = 0;
+    for (int slot = 0; slot < AdcSlotCount; slot++) {
+        pinmap_pinout(adc_pins[slot], PinMap_ADC);
+        channel.Channel = __LL_ADC_DECIMAL_NB_TO_CHANNEL(STM_PIN_CHANNEL(pinmap_function(adc_pins[slot], PinMap_ADC)));
+        channel.Rank = adc_ranks[slot];
+        if (HAL_ADC_ConfigChannel(&adc_handle, &channel) != HAL_OK) {
+            return -3;
+        }
+    }
+
+    if (HAL_ADCEx_Calibration_Start(&adc_handle, ADC_SINGLE_ENDED) != HAL_OK) {
+        return -4;
+    }
+
+    NVIC_SetVector(DMA1_Channel1_IRQn, (uint32_t)&adc_dma_irq_handler);
+    HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+    return 0;
+}
+
+#elif defined(TARGET_STM32F4)
+
+static int adc_hw_init(void) {
+    __HAL_RCC_ADC1_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    adc_dma_handle.Instance = DMA2_Stream0;
+    adc_dma_handle.Init.Channel = DMA_CHANNEL_0;
+    adc_dma_handle.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    adc_dma_handle.Init.PeriphInc = DMA_PINC_DISABLE;
+    adc_dma_handle.Init.MemInc = DMA_MINC_ENABLE;
+    adc_dma_handle.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    adc_dma_handle.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    adc_dma_handle.Init.Mode = DMA_CIRCULAR;
+    adc_dma_handle.Init.Priority = DMA_PRIORITY_MEDIUM;
+    adc_dma_handle.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&adc_dma_handle) != HAL_OK) {
+        return -1;
+    }
+    __HAL_LINKDMA(&adc_handle, DMA_Handle, adc_dma_handle);
+
+    adc_handle.Instance = ADC1;
+    adc_handle.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
+    adc_handle.Init.Resolution = ADC_RESOLUTION_12B;
+    adc_handle.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    adc_handle.Init.ScanConvMode = ENABLE;
+    adc_handle.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    adc_handle.Init.ContinuousConvMode = DISABLE;
+    adc_handle.Init.NbrOfConversion = AdcSlotCount;
+    adc_handle.Init.DiscontinuousConvMode = DISABLE;
+    adc_handle.Init.ExternalTrigConv = Board::ADC_TRIGGER;
+    adc_handle.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+    adc_handle.Init.DMAContinuousRequests = ENABLE;
+    if (HAL_ADC_Init(&adc_handle) != HAL_OK) {
+        return -2;
+    }
+
+    ADC_ChannelConfTypeDef channel = {0};
+    channel.SamplingTime = ADC_SAMPLETIME_84CYCLES;
+    for (int slot = 0; slot < AdcSlotCount; slot++) {
+        pinmap_pinout(adc_pins[slot], PinMap_ADC);
+        channel.Channel = STM_PIN_CHANNEL(pinmap_function(adc_pins[slot], PinMap_ADC));
+        channel.Rank = slot + 1;
+        if (HAL_ADC_ConfigChannel(&adc_handle, &channel) != HAL_OK) {
+            return -3;
+        }
+    }
+
+    NVIC_SetVector(DMA2_Stream0_IRQn, (uint32_t)&adc_dma_irq_handler);
+    HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+    return 0;
+}
+
+#else
+#error "adc_scan.cpp: unsupported STM32 family"
+#endif
+
+int adc_scan_init(void) {
+    int ret;
+
+    for (int slot = 0; slot < AdcSlotCount; slot++) {
+        adc_acc[slot] = 0;
+        adc_avg[slot] = ADC_SCAN_INVALID;
+    }
+
+    ret = adc_hw_init();
+    if (ret != 0) {
+        return ret;
+    }
+    if (HAL_ADC_Start_DMA(&adc_handle, (uint32_t *)adc_dma_buf, ADC_DMA_LEN) != HAL_OK) {
+        return -5;
+    }
+    ret = adc_timer_init();
+    if (ret != 0) {
+        return ret;
+    }
+
+    // timer, ADC and DMA stop in STOP mode
+    sleep_manager_lock_deep_sleep();
+    return 0;
+}
+
+uint16_t adc_scan_get(int slot) {
+    return adc_avg[slot];
+}
+
+void adc_scan_attach(adc_block_handler_t handler) {
+    adc_block_handler = handler;
+}
+
+/**********************************************************************
+* Function: adc_timer_init
+* Parameters: --
+* Returns: 0 ok, negative on HAL error
+*
+* Description: Board::spare_timer() counts at 1MHz and fires TRGO at
+* ADC_SCAN_RATE_HZ, every TRGO starts one scan of the sequence
+**********************************************************************/
+static int adc_timer_init(void) {
+    TIM_MasterConfigTypeDef master = {0};
+    uint32_t tim_clk = HAL_RCC_GetPCLK1Freq();
+
+    // APB1 timers run at 2x PCLK1 whenever the bus is divided
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        tim_clk *= 2;
+    }
+
+    Board::spare_timer_clk_enable();
+    adc_tim_handle.Instance = Board::spare_timer();
+    adc_tim_handle.Init.Prescaler = (tim_clk / 1000000) - 1;
+    adc_tim_handle.Init.CounterMode = TIM_COUNTERMODE_UP;
+    adc_tim_handle.Init.Period = (1000000 / ADC_SCAN_RATE_HZ) - 1;
+    adc_tim_handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+    if (HAL_TIM_Base_Init(&adc_tim_handle) != HAL_OK) {
+        return -6;
+    }
+
+    master.MasterOutputTrigger = TIM_TRGO_UPDATE;
+    master.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+    if (HAL_TIMEx_MasterConfigSynchronization(&adc_tim_handle, &master) != HAL_OK) {
+        return -7;
+    }
+    if (HAL_TIM_Base_Start(&adc_tim_handle) != HAL_OK) {
+        return -8;
+    }
+    return 0;
+}
+
+/**********************************************************************
+* Function: adc_process_block
+* Parameters: p_block - ADC_BLOCK_SCANS finished sequences
+* Returns: --
+*
+* Description: runs in the DMA interrupt, passes the block to the attached
+* handler, accumulates it and publishes the per slot mean every
+* ADC_AVG_BLOCKS blocks
+**********************************************************************/
+static void adc_process_block(const uint16_t *p_block) {
+    if (adc_block_handler != NULL) {
+        adc_block_handler(p_block);
+    }
+
+    for (int scan = 0; scan < ADC_BLOCK_SCANS; scan++) {
+        for (int slot = 0; slot < AdcSlotCount; slot++) {
+            adc_acc[slot] += *p_block++;
+        }
+    }
+
+    if (++adc_acc_blocks >= ADC_AVG_BLOCKS) {
+        for (int slot = 0; slot < AdcSlotCount; slot++) {
+            adc_avg[slot] = adc_acc[slot] / (ADC_AVG_BLOCKS * ADC_BLOCK_SCANS);
+            adc_acc[slot] = 0;
+        }
+        adc_acc_blocks = 0;
+    }
+}
+
+static void adc_dma_irq_handler(void) {
+    HAL_DMA_IRQHandler(&adc_dma_handle);
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc) {
+    if (hadc == &adc_handle) {
+        adc_process_block(&adc_dma_buf[0]);
+    }
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc) {
+    if (hadc == &adc_handle) {
+        adc_process_block(&adc_dma_buf[ADC_DMA_LEN / 2]);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __ADC_SCAN_H__
+#define __ADC_SCAN_H__
+
+#include "mbed.h"
+#include <cstdint>
+
+/*
+ * Background sampling of all analog inputs on ADC1.
+ * Board::spare_timer() triggers one scan of the sequence at ADC_SCAN_RATE_HZ,
+ * DMA stores the results into a circular buffer and interrupts once per half
+ * buffer (ADC_BLOCK_SCANS sequences). The CPU only sums up finished blocks.
+ * STM32L4 additionally oversamples every conversion 16x in hardware.
+ * A block handler may be attached to inspect each raw block right in the
+ * DMA interrupt, ADC_BLOCK_SCANS / ADC_SCAN_RATE_HZ = 16ms after sampling.
+ */
+
+#define ADC_SCAN_RATE_HZ    1000
+#define ADC_BLOCK_SCANS     16
+// blocks averaged into one published value, 64 * 16 / 1kHz ~ 1s
+#define ADC_AVG_BLOCKS      64
+
+// position of each input in the scan sequence
+enum e_ADC_SLOT {
+    AdcMoist12V = 0,
+    AdcMoistA,
+    AdcMoistB,
+    AdcCurrent12V,
+    AdcCurrentA,
+    AdcCurrentB,
+    AdcSlotCount
+};
+
+/** Configure timer, ADC and DMA and start the background scan
+ *
+ * @returns 0 on success, negative HAL step that failed otherwise
+ */
+int adc_scan_init(void);
+
+/** Latest averaged reading of one slot, 12-bit full scale
+ *
+ * @returns ADC_SCAN_INVALID until the first average is complete
+ */
+uint16_t adc_scan_get(int slot);
+
+#define ADC_SCAN_INVALID    0xFFFF
+
+/** Handler of one finished block, sample of slot s in scan n is p_block[n * AdcSlotCount + s] */
+typedef void (*adc_block_handler_t)(const uint16_t *p_block);
+
+/** Attach a handler called from the DMA interrupt for every block, NULL to detach */
+void adc_scan_attach(adc_block_handler_t handler);
+
+#endif
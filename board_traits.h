@@ -0,0 +1,119 @@
+#ifndef __BOARD_TRAITS_H__
+#define __BOARD_TRAITS_H__
+
+#include "mbed.h"
+#include <cstdint>
+
+/*
+ * Compile time board description, one struct per supported board.
+ * Only the struct matching the mbed target is compiled (it refers to family
+ * specific HAL names) and exported as `Board`, everything in it
+ * is static constexpr -> no RAM, no runtime branching, unused paths get dropped.
+ *
+ * Each board provides:
+ * - pin map of the leds/pumps/fan/buttons and the I2C bus (LCD + RTC)
+ * - BUS_*_PIN          UART of the pump bus to other controllers, DE = RS-485 driver enable
+ * - I2C_HZ             bus speed, PCF8574 LCD backpack is limited to 100kHz
+ * - LED_ON             level that lights the status leds
+ * - PUMP_SHUNTS        pump outputs have current shunts, false = pump guard off by default
+ * - HISTORY_LOG_SECTORS flash sectors at the end of the flash used by HistoryLog,
+ *                      the two sectors below them hold the ConfigStore banks
+ * - MOIST_*_PIN        soil moisture probe per zone, must be ADC1 capable
+ * - CURRENT_*_PIN      pump current shunt amplifier per zone, ADC1 capable
+ * - spare_timer()      hardware timer not claimed by the mbed us/lp ticker,
+ *                      paces the ADC scan, ADC_TRIGGER is its TRGO trigger source
+ */
+
+#if defined(TARGET_STM32L433xC)
+
+// STM32L433RC nucleo, leds of the shield stand in for the pumps
+struct BoardNucleoL433 {
+    static constexpr PinName RED_LED_PIN    = PC_8;     // heartbeat
+    static constexpr PinName BLUE_LED_PIN   = PB_8;     // wattering time reached
+    static constexpr PinName PUMP_A_PIN     = PB_7;     // green led, stromecek
+    static constexpr PinName PUMP_B_PIN     = PC_6;     // white led, kvetinace
+    static constexpr PinName PUMP_12V_PIN   = PC_4;
+    static constexpr PinName FAN_EN_PIN     = PB_15;
+
+    static constexpr PinName SELECT_BTN_PIN = PA_15;
+    static constexpr PinName ENTER_BTN_PIN  = PB_5;
+
+    static constexpr PinName I2C_SDA_PIN    = PA_10;
+    static constexpr PinName I2C_SCL_PIN    = PA_9;
+    static constexpr int I2C_HZ             = 100000;
+
+    static constexpr PinName BUS_TX_PIN     = PC_10;    // USART3
+    static constexpr PinName BUS_RX_PIN     = PC_11;
+    static constexpr PinName BUS_DE_PIN     = PB_9;
+
+    static constexpr PinName MOIST_12V_PIN  = PA_0;     // ADC1_IN5
+    static constexpr PinName MOIST_A_PIN    = PA_1;     // ADC1_IN6
+    static constexpr PinName MOIST_B_PIN    = PA_4;     // ADC1_IN9
+
+    static constexpr PinName CURRENT_12V_PIN = PC_0;    // ADC1_IN1
+    static constexpr PinName CURRENT_A_PIN   = PC_1;    // ADC1_IN2
+    static constexpr PinName CURRENT_B_PIN   = PC_2;    // ADC1_IN3
+
+    static constexpr int LED_ON             = 1;
+    static constexpr bool PUMP_SHUNTS       = false;    // leds draw next to nothing
+
+    static constexpr int HISTORY_LOG_SECTORS = 4;   // 2KB pages, config in the 2 pages below
+
+    // us_ticker runs on TIM2
+    static TIM_TypeDef *spare_timer() { return TIM6; }
+    static void spare_timer_clk_enable() { __HAL_RCC_TIM6_CLK_ENABLE(); }
+    static constexpr uint32_t ADC_TRIGGER   = ADC_EXTERNALTRIG_T6_TRGO;
+};
+typedef BoardNucleoL433 Board;
+
+#elif defined(TARGET_STM32F411xE)
+
+// STM32F411CE blackpill (pins exist on the NUCLEO_F411RE as well)
+// mbed_app.json limits the application size for the STM32F411xE label, a custom
+// blackpill target has to carry it (inherit from MCU_STM32F411xE) or the
+// history log and config store refuse to overlap the application
+struct BoardBlackpillF411 {
+    static constexpr PinName RED_LED_PIN    = PC_13;    // on-board led, active low
+    static constexpr PinName BLUE_LED_PIN   = PA_8;
+    static constexpr PinName PUMP_A_PIN     = PB_12;
+    static constexpr PinName PUMP_B_PIN     = PB_13;
+    static constexpr PinName PUMP_12V_PIN   = PB_14;
+    static constexpr PinName FAN_EN_PIN     = PB_15;
+
+    static constexpr PinName SELECT_BTN_PIN = PA_15;
+    static constexpr PinName ENTER_BTN_PIN  = PB_5;
+
+    static constexpr PinName I2C_SDA_PIN    = PB_7;
+    static constexpr PinName I2C_SCL_PIN    = PB_6;
+    static constexpr int I2C_HZ             = 100000;
+
+    static constexpr PinName BUS_TX_PIN     = PA_9;     // USART1
+    static constexpr PinName BUS_RX_PIN     = PA_10;
+    static constexpr PinName BUS_DE_PIN     = PB_9;
+
+    static constexpr PinName MOIST_12V_PIN  = PA_0;     // ADC1_IN0
+    static constexpr PinName MOIST_A_PIN    = PA_1;     // ADC1_IN1
+    static constexpr PinName MOIST_B_PIN    = PA_4;     // ADC1_IN4
+
+    static constexpr PinName CURRENT_12V_PIN = PA_5;    // ADC1_IN5
+    static constexpr PinName CURRENT_A_PIN   = PA_6;    // ADC1_IN6
+    static constexpr PinName CURRENT_B_PIN   = PA_7;    // ADC1_IN7
+
+    static constexpr int LED_ON             = 0;
+    static constexpr bool PUMP_SHUNTS       = true;
+
+    // 128KB sectors 6 and 7, config in sectors 4 and 5 -> application in sectors 0-3 (64KB)
+    static constexpr int HISTORY_LOG_SECTORS = 2;
+
+    // us_ticker runs on TIM5
+    static TIM_TypeDef *spare_timer() { return TIM3; }
+    static void spare_timer_clk_enable() { __HAL_RCC_TIM3_CLK_ENABLE(); }
+    static constexpr uint32_t ADC_TRIGGER   = ADC_EXTERNALTRIGCONV_T3_TRGO;
+};
+typedef BoardBlackpillF411 Board;
+
+#else
+#error "board_traits.h: no board description for this target"
+#endif
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: config_store.cpp
+ *
+ * __Description:__
+ * runtime configuration in the internal flash (FlashIAP), see config_store.h
+ * - two sectors (banks) right below the HistoryLog region, used in turns
+ * - records appended as a prefix of a bank, end found by binary search
+ *******************************************************************************/
+
+#include "config_store.h"
+#include "history_log.h"
+#include <cstddef>
+
+#if !DEVICE_FLASH
+#error "ConfigStore requires FlashIAP (DEVICE_FLASH)"
+#endif
+
+MBED_STATIC_ASSERT(sizeof(app_config_t) == 192, "config record must stay 192B");
+MBED_STATIC_ASSERT(offsetof(app_config_t, crc) == sizeof(app_config_t) - 4, "crc must be the last field");
+
+static volatile bool flash_ecc_error = false;
+
+#if defined(FLASH_ECCR_ECCD)
+/**********************************************************************
+* Function: NMI_Handler
+* Parameters: --
+* Returns: --
+*
+* Description: L4 flash ECC double error, e.g. a record cut off by a power
+* loss while programming. The flag is cleared and the read goes on with
+* garbage data, ConfigStore::read() reports it. Any other NMI stops here
+* like the default handler.
+**********************************************************************/
+extern "C" void NMI_Handler(void) {
+    if (FLASH->ECCR & FLASH_ECCR_ECCD) {
+        FLASH->ECCR |= FLASH_ECCR_ECCD;
+        flash_ecc_error = true;
+        return;
+    }
+    while (true) {
+    }
+}
+#endif
+
+ConfigStore::ConfigStore() :
+    _ready(false), _active(0), _next_seq(0)
+{
+    for (int bank = 0; bank < CONFIG_BANKS; bank++) {
+        _base[bank] = 0;
+        _sector_size[bank] = 0;
+        _slots[bank] = 0;
+        _head[bank] = 0;
+    }
+}
+
+int ConfigStore::init() {
+    if (_flash.init() != 0) {
+        return -1;
+    }
+
+    uint32_t flash_end = _flash.get_flash_start() + _flash.get_flash_size();
+    uint32_t below = flash_end - (HISTORY_LOG_SECTORS * _flash.get_sector_size(flash_end - 1));
+
+    if ((sizeof(app_config_t) % _flash.get_page_size()) != 0) {
+        return -3;
+    }
+
+    // bank 1 right below the log, bank 0 below it
+    for (int bank = CONFIG_BANKS - 1; bank >= 0; bank--) {
+        _sector_size[bank] = _flash.get_sector_size(below - 1);
+        _base[bank] = below - _sector_size[bank];
+        _slots[bank] = _sector_size[bank] / sizeof(app_config_t);
+        below = _base[bank];
+    }
+#ifdef FLASHIAP_APP_ROM_END_ADDR
+    if (_base[0] < FLASHIAP_APP_ROM_END_ADDR) {
+        printf("cfg: region 0x%08lx overlaps application\r\n", (unsigned long)_base[0]);
+        return -4;
+    }
+#endif
+
+    // written records are a prefix of each bank
+    for (int bank = 0; bank < CONFIG_BANKS; bank++) {
+        uint32_t lo = 0;
+        uint32_t hi = _slots[bank];
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (slot_erased(bank, mid)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        _head[bank] = lo;
+    }
+    _active = 0;
+    _next_seq = 0;
+
+    _ready = true;
+    return 0;
+}
+
+int ConfigStore::load(app_config_t *cfg) {
+    app_config_t rec;
+    int result = -1;
+    bool found = false;
+
+    if (!_ready) {
+        return -1;
+    }
+
+    // the bank holding the newest valid record takes the next saves
+    for (int bank = 0; bank < CONFIG_BANKS; bank++) {
+        int bank_result = newest(bank, &rec);
+
+        if (bank_result == 0) {
+            if (!found || (rec.seq >= _next_seq)) {
+                found = true;
+                _active = bank;
+                _next_seq = rec.seq + 1;
+                *cfg = rec;
+            }
+        } else if (bank_result < result) {
+            result = bank_result;
+        }
+    }
+    if (found) {
+        return 0;
+    }
+    return result;
+}
+
+int ConfigStore::save(app_config_t *cfg) {
+    if (!_ready) {
+        return -1;
+    }
+
+    // the full bank keeps its newest record until the other one took the new
+    if (_head[_active] >= _slots[_active]) {
+        int other = (_active + 1) % CONFIG_BANKS;
+        if (_flash.erase(_base[other], _sector_size[other]) != 0) {
+            return -2;
+        }
+        _head[other] = 0;
+        _active = other;
+    }
+
+    cfg->magic = CONFIG_MAGIC;
+    cfg->version = CONFIG_VERSION;
+    cfg->size = sizeof(app_config_t);
+    cfg->seq = _next_seq;
+    cfg->crc = crc32((const uint8_t *)cfg, offsetof(app_config_t, crc));
+
+    if (_flash.program(cfg, slot_addr(_active, _head[_active]), sizeof(*cfg)) != 0) {
+        // half programmed slot fails the crc, skip it
+        _head[_active]++;
+        return -3;
+    }
+    _head[_active]++;
+    _next_seq++;
+    return 0;
+}
+
+/**********************************************************************
+* Function: newest
+* Parameters: bank - 0..CONFIG_BANKS-1
+*             rec - newest valid record of the bank
+* Returns: 0 found, -1 bank empty, -2 no record passes the CRC,
+*          -3 bank written with another CONFIG_VERSION
+*
+* Description: newest first, a torn save (crc or ecc error) falls back to
+* the record before it; after a layout change the slots no longer line
+* up, the aligned slot 0 still shows the header of the old version
+**********************************************************************/
+int ConfigStore::newest(int bank, app_config_t *rec) {
+    int result = -1;
+
+    for (uint32_t slot = _head[bank]; slot > 0; slot--) {
+        if ((read(rec, slot_addr(bank, slot - 1), sizeof(*rec)) != 0) || (rec->magic != CONFIG_MAGIC)) {
+            result = -2;
+            continue;
+        }
+        if ((rec->version != CONFIG_VERSION) || (rec->size != sizeof(app_config_t))) {
+            // older layout, erased before the bank is written again
+            if (rec->seq >= _next_seq) {
+                _next_seq = rec->seq + 1;
+            }
+            _head[bank] = _slots[bank];
+            return -3;
+        }
+        if (rec->crc != crc32((const uint8_t *)rec, offsetof(app_config_t, crc))) {
+            result = -2;
+            continue;
+        }
+        return 0;
+    }
+    return result;
+}
+
+bool ConfigStore::slot_erased(int bank, uint32_t slot) {
+    uint32_t word;
+    uint8_t erased = _flash.get_erase_value();
+
+    // a torn first double word counts as written, the next save goes behind it
+    if (read(&word, slot_addr(bank, slot), sizeof(word)) != 0) {
+        return false;
+    }
+    return (word == ((uint32_t)erased * 0x01010101u));
+}
+
+int ConfigStore::read(void *buf, uint32_t addr, size_t len) {
+    flash_ecc_error = false;
+    if (_flash.read(buf, addr, len) != 0) {
+        return -1;
+    }
+    return flash_ecc_error ? -2 : 0;
+}
+
+// CRC-32 (IEEE 802.3), bitwise, a record takes ~10us
+uint32_t ConfigStore::crc32(const uint8_t *p, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
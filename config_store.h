@@ -0,0 +1,111 @@
+#ifndef __CONFIG_STORE_H__
+#define __CONFIG_STORE_H__
+
+#include "mbed.h"
+#include <cstdint>
+
+#include "main_types.h"
+#include "board_traits.h"
+#include "schedule.h"
+#include "pump_guard.h"
+
+#define CONFIG_MAGIC        0x4A53      // "SJ"
+// bump when the layout of app_config_t changes, older records are then ignored
+#define CONFIG_VERSION      4
+
+/** Runtime tunables, 192B so it is a whole number of L4 double words */
+typedef struct {
+    uint16_t magic;
+    uint8_t  version;
+    uint8_t  size;                          // sizeof(app_config_t) of the writer
+    uint32_t seq;                           // save counter, newest record wins
+    uint16_t runtime_s[ZoneCount];          // base pump runtime per zone
+    uint16_t pause_s;                       // pause between the pump steps
+    uint16_t moist_wet_level[ZoneCount];    // raw adc, zone skipped below
+    temp_q_t fan_on_q;
+    temp_q_t fan_off_q;
+    uint16_t temp_gain[ZoneCount];          // % of the heat scaling applied to a zone
+    uint16_t temp_dh_ref_ch;                // degC*h for 100% runtime
+    uint8_t  sched_count;
+    uint8_t  reserved1;
+    sched_slot_t sched[SCHED_MAX_SLOTS];    // sorted, see Schedule
+    pump_limits_t pump_limits[ZoneCount];   // shunt bands, 0 = check off
+    uint8_t  reserved[6];
+    uint32_t crc;                           // CRC-32 over the bytes above
+} app_config_t;
+
+#define CONFIG_BANKS        2
+
+/** Versioned, CRC checked configuration in the two flash sectors below the history log
+ *
+ * Saves are appended one after another in the active sector (bank). When it
+ * is full, the other bank is erased and continues, so the newest record of
+ * the full bank survives until the new one is programmed; a power loss
+ * during any save leaves the previous record intact. Loading is a binary
+ * search for the end of the written records of each bank followed by a CRC
+ * check of the newest ones, the higher seq wins, microseconds from memory
+ * mapped flash. The banks may differ in size (F411 sectors 4 and 5).
+ *
+ * On the L4 a double word cut off while being programmed fails its ECC and
+ * reading it raises the NMI; the handler here clears the flag, the read is
+ * then reported as failed and load() falls back to the record before.
+ * The header is checked before the CRC, records of another CONFIG_VERSION
+ * (likely another size, so the slots no longer line up) give -3 and their
+ * bank counts as full, it is erased before it takes records again.
+ *
+ * @code
+ * ConfigStore cfg_store;
+ * app_config_t cfg;
+ *
+ * config_defaults(&cfg);
+ * if ((cfg_store.init() == 0) && (cfg_store.load(&cfg) != 0)) {
+ *     printf("cfg: defaults\r\n");
+ * }
+ * @endcode
+ */
+class ConfigStore {
+public:
+    ConfigStore();
+
+    /** Locate the config sectors below the history log
+     *
+     * @returns 0 on success, negative when flash is unusable
+     */
+    int init();
+
+    /** Copy the newest valid record into cfg
+     *
+     * @returns 0 loaded, -1 nothing stored, -2 no record passes the CRC,
+     *          -3 stored with another CONFIG_VERSION; cfg untouched on error
+     */
+    int load(app_config_t *cfg);
+
+    /** Store cfg as the newest record, fills in the header and CRC
+     *
+     * Erases the other bank first when the active one is full, which blocks
+     * for the sector erase time (up to ~2s on a 128KB F4 sector), call it
+     * while idle.
+     *
+     * @returns 0 on success, negative on flash error
+     */
+    int save(app_config_t *cfg);
+
+private:
+    uint32_t slot_addr(int bank, uint32_t slot) const { return _base[bank] + slot * sizeof(app_config_t); }
+    bool slot_erased(int bank, uint32_t slot);
+    int newest(int bank, app_config_t *rec);
+    int read(void *buf, uint32_t addr, size_t len);
+    static uint32_t crc32(const uint8_t *p, size_t len);
+
+    FlashIAP _flash;
+    bool _ready;
+
+    uint32_t _base[CONFIG_BANKS];
+    uint32_t _sector_size[CONFIG_BANKS];
+    uint32_t _slots[CONFIG_BANKS];
+    uint32_t _head[CONFIG_BANKS];   // first free slot
+    int _active;                    // bank the next save appends to
+    uint32_t _next_seq;
+};
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: history_log.cpp
+ *
+ * __Description:__
+ * append-only watering history in the internal flash (FlashIAP)
+ * - fixed 16B records, record address computed from its index -> O(1) append/read
+ * - last HISTORY_LOG_SECTORS sectors used as a ring, sector ahead of the head
+ *   is erased in service() only when no pump step is running and the head is
+ *   close to the end of its sector
+ * - write head recovered at boot by binary search inside the newest sector
+ *******************************************************************************/
+
+#include "history_log.h"
+#include <cstddef>
+#include "platform/ScopedLock.h"
+
+#if !DEVICE_FLASH
+#error "HistoryLog requires FlashIAP (DEVICE_FLASH)"
+#endif
+
+MBED_STATIC_ASSERT(HISTORY_LOG_SECTORS >= 2, "history log needs at least 2 sectors to rotate");
+MBED_STATIC_ASSERT(sizeof(history_record_t) == 16, "history record must stay 16B");
+
+HistoryLog::HistoryLog() :
+    _ready(false),
+    _base(0), _sector_size(0), _slots_per_sector(0), _total_slots(0),
+    _head(0), _next_seq(0), _oldest_slot(0), _oldest_seq(0),
+    _erase_pending(-1),
+    _pending_first(0), _pending_count(0), _dropped(0)
+{
+}
+
+int HistoryLog::init() {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (_flash.init() != 0) {
+        return -1;
+    }
+
+    uint32_t flash_end = _flash.get_flash_start() + _flash.get_flash_size();
+
+    _sector_size = _flash.get_sector_size(flash_end - 1);
+    _base = flash_end - (HISTORY_LOG_SECTORS * _sector_size);
+
+    // ring indexing assumes equal sectors
+    for (uint32_t addr = _base; addr < flash_end; addr += _sector_size) {
+        if (_flash.get_sector_size(addr) != _sector_size) {
+            return -2;
+        }
+    }
+    if ((sizeof(history_record_t) % _flash.get_page_size()) != 0) {
+        return -3;
+    }
+#ifdef FLASHIAP_APP_ROM_END_ADDR
+    if (_base < FLASHIAP_APP_ROM_END_ADDR) {
+        printf("HLog: region 0x%08lx overlaps application\r\n", (unsigned long)_base);
+        return -4;
+    }
+#endif
+
+    _slots_per_sector = _sector_size / sizeof(history_record_t);
+    _total_slots = _slots_per_sector * HISTORY_LOG_SECTORS;
+
+    // newest sector = the one starting with the highest sequence number
+    int head_sector = -1;
+    uint32_t head_first_seq = 0;
+    for (int s = 0; s < HISTORY_LOG_SECTORS; s++) {
+        uint32_t seq = read_seq(s * _slots_per_sector);
+        if ((seq != HISTORY_SEQ_ERASED) && ((head_sector < 0) || (seq > head_first_seq))) {
+            head_sector = s;
+            head_first_seq = seq;
+        }
+    }
+
+    if (head_sector < 0) {
+        //empty log
+        _head = 0;
+        _next_seq = 0;
+        _oldest_slot = 0;
+        _oldest_seq = 0;
+    } else {
+        // records are appended in order -> free slots are a suffix of the sector
+        uint32_t first = head_sector * _slots_per_sector;
+        uint32_t lo = 1;
+        uint32_t hi = _slots_per_sector;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (read_seq(first + mid) == HISTORY_SEQ_ERASED) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        _next_seq = read_seq(first + lo - 1) + 1;
+        _head = (first + lo) % _total_slots;
+        find_oldest(head_sector);
+    }
+
+    // head at a sector start which still holds old data -> erase before use,
+    // otherwise the sector after the head once the head gets close to it
+    if (((_head % _slots_per_sector) == 0) && (read_seq(_head) != HISTORY_SEQ_ERASED)) {
+        _erase_pending = _head / _slots_per_sector;
+    } else {
+        schedule_erase_ahead();
+    }
+
+    _ready = true;
+    return 0;
+}
+
+int HistoryLog::append(uint8_t event, uint8_t zone, uint16_t duration_s, temp_q_t temp_q, uint32_t epoch) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (!_ready) {
+        return -1;
+    }
+
+    history_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.epoch = epoch;
+    rec.event = event;
+    rec.zone = zone;
+    rec.duration_s = duration_s;
+    rec.temp_q = temp_q;
+
+    bool head_writable = (_erase_pending != (int)(_head / _slots_per_sector));
+    if ((_pending_count == 0) && head_writable) {
+        return program_record(&rec);
+    }
+
+    if (_pending_count >= HISTORY_LOG_PENDING) {
+        _dropped++;
+        return -2;
+    }
+    _pending[(_pending_first + _pending_count) % HISTORY_LOG_PENDING] = rec;
+    _pending_count++;
+    return 1;
+}
+
+void HistoryLog::service(bool busy) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (!_ready) {
+        return;
+    }
+
+    if (_erase_pending >= 0) {
+        if (busy) {
+            return;
+        }
+        int erased = _erase_pending;
+        if (_flash.erase(_base + erased * _sector_size, _sector_size) != 0) {
+            return;
+        }
+        _erase_pending = -1;
+        find_oldest(erased);
+        schedule_erase_ahead();
+    }
+
+    while ((_pending_count > 0) && (_erase_pending != (int)(_head / _slots_per_sector))) {
+        if (program_record(&_pending[_pending_first]) != 0) {
+            break;
+        }
+        _pending_first = (_pending_first + 1) % HISTORY_LOG_PENDING;
+        _pending_count--;
+    }
+}
+
+uint32_t HistoryLog::count() const {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (!_ready) {
+        return 0;
+    }
+    return _next_seq - _oldest_seq;
+}
+
+int HistoryLog::read(uint32_t index, history_record_t *rec) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (index >= count()) {
+        return -1;
+    }
+
+    uint32_t slot = (_oldest_slot + index) % _total_slots;
+    if (_flash.read(rec, slot_addr(slot), sizeof(*rec)) != 0) {
+        return -2;
+    }
+    if ((rec->seq != _oldest_seq + index) || (rec->check != checksum(rec))) {
+        return -2;
+    }
+    return 0;
+}
+
+int HistoryLog::program_record(history_record_t *rec) {
+    rec->seq = _next_seq;
+    rec->check = checksum(rec);
+
+    if (_flash.program(rec, slot_addr(_head), sizeof(*rec)) != 0) {
+        return -1;
+    }
+    _next_seq++;
+    _head = (_head + 1) % _total_slots;
+
+    schedule_erase_ahead();
+    return 0;
+}
+
+uint32_t HistoryLog::slot_addr(uint32_t slot) const {
+    return _base + (slot * sizeof(history_record_t));
+}
+
+uint32_t HistoryLog::read_seq(uint32_t slot) {
+    uint32_t seq = HISTORY_SEQ_ERASED;
+    _flash.read(&seq, slot_addr(slot), sizeof(seq));
+    return seq;
+}
+
+/**********************************************************************
+* Function: schedule_erase_ahead
+* Parameters: --
+* Returns: --
+*
+* Description: near the end of the head sector the following sector gets
+* scheduled for erase, unless an erase is pending already (the head then
+* caught up with it) or the sector is blank
+**********************************************************************/
+void HistoryLog::schedule_erase_ahead(void) {
+    if ((_erase_pending >= 0) || ((_slots_per_sector - (_head % _slots_per_sector)) > HISTORY_LOG_ERASE_AHEAD)) {
+        return;
+    }
+
+    int next = ((_head / _slots_per_sector) + 1) % HISTORY_LOG_SECTORS;
+    if (read_seq(next * _slots_per_sector) != HISTORY_SEQ_ERASED) {
+        _erase_pending = next;
+    }
+}
+
+/**********************************************************************
+* Function: find_oldest
+* Parameters: after_sector - search starts at the sector following this one
+* Returns: --
+*
+* Description: oldest record = first used sector found walking the ring
+* forward from after_sector, empty log when all of them are free
+**********************************************************************/
+void HistoryLog::find_oldest(int after_sector) {
+    for (int k = 1; k <= HISTORY_LOG_SECTORS; k++) {
+        int s = (after_sector + k) % HISTORY_LOG_SECTORS;
+        uint32_t seq = read_seq(s * _slots_per_sector);
+        if (seq != HISTORY_SEQ_ERASED) {
+            _oldest_slot = s * _slots_per_sector;
+            _oldest_seq = seq;
+            return;
+        }
+    }
+    _oldest_slot = _head;
+    _oldest_seq = _next_seq;
+}
+
+uint16_t HistoryLog::checksum(const history_record_t *rec) {
+    const uint8_t *p = (const uint8_t *)rec;
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+
+    for (size_t i = 0; i < offsetof(history_record_t, check); i++) {
+        sum1 = (sum1 + p[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
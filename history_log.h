@@ -0,0 +1,145 @@
+#ifndef __HISTORY_LOG_H__
+#define __HISTORY_LOG_H__
+
+#include "mbed.h"
+#include "platform/PlatformMutex.h"
+#include <cstdint>
+
+#include "main_types.h"
+#include "board_traits.h"
+
+// number of (equally sized) flash sectors at the end of the internal flash
+// reserved for the log, keep in sync with target.mbed_app_size in mbed_app.json
+// (which also leaves room for the two ConfigStore sectors below the log)
+#ifndef HISTORY_LOG_SECTORS
+#define HISTORY_LOG_SECTORS (Board::HISTORY_LOG_SECTORS)
+#endif
+
+// records kept in RAM while the sector ahead of the write head waits for erase
+#define HISTORY_LOG_PENDING 8
+
+// free slots left in the head sector when the following sector is scheduled for
+// erase, the oldest records are kept until then; must cover the appends of a
+// wattering cycle, the erase is postponed while busy
+#ifndef HISTORY_LOG_ERASE_AHEAD
+#define HISTORY_LOG_ERASE_AHEAD 32
+#endif
+
+#define HISTORY_SEQ_ERASED 0xFFFFFFFF
+
+enum e_HISTORY_EVENT {
+    HistNone = 0,
+    HistBoot,
+    HistCycleStart,
+    HistPumpRun,
+    HistCycleEnd,
+    HistFanOn,
+    HistFanOff,
+    HistZoneSkipped,
+    HistCycleSkipped,
+    HistPumpOpen,
+    HistPumpDryRun,
+    HistPumpStall,
+    HistSlotTimeout
+};
+
+/** One fixed-size log entry, 16B so it fits the L4 double-word program unit */
+typedef struct {
+    uint32_t seq;           // monotonic sequence number, HISTORY_SEQ_ERASED = free slot
+    uint32_t epoch;         // rtc epoch of the event
+    uint8_t  event;         // e_HISTORY_EVENT
+    uint8_t  zone;          // e_ZONE
+    uint16_t duration_s;    // pump/cycle runtime in seconds
+    temp_q_t temp_q;        // temperature in 1/4 degC
+    uint16_t check;         // fletcher16 over the bytes above
+} history_record_t;
+
+/** Append-only event log in a ring of internal flash sectors
+ *
+ * Records are programmed one after another, the write head walks through the
+ * sectors and wraps around. When the head is HISTORY_LOG_ERASE_AHEAD slots from
+ * the end of its sector, the following one (holding the oldest records) is
+ * scheduled for erase, so the log keeps all but that last stretch of the ring.
+ * The erase itself only happens in service() while the caller is not busy, so
+ * appends never wait for a sector erase. Record N is always found at a computed
+ * address, no scanning.
+ *
+ * The erase stalls the CPU (code runs from the same flash): a few ms for a 2KB
+ * L4 page, 1-2s for a 128KB F411 sector, which happens once per ~8k records.
+ * The public calls are serialized with a PlatformMutex (no-op on bare metal),
+ * so the RTOS build may read the log from another thread.
+ *
+ * @code
+ * HistoryLog history;
+ *
+ * history.init();
+ * history.append(HistBoot, ZoneNone, 0, 0, rtc.get_epoch());
+ * while (true) {
+ *     history.service(flag_wattering_in_progress);
+ * }
+ * @endcode
+ */
+class HistoryLog {
+public:
+    HistoryLog();
+
+    /** Locate the reserved region and recover the write head
+     *
+     * @returns 0 on success, negative when the log is unusable (appends are then ignored)
+     */
+    int init();
+
+    /** Append one event, O(1)
+     *
+     * @returns 0 when programmed, 1 when queued in RAM, negative on error/drop
+     */
+    int append(uint8_t event, uint8_t zone, uint16_t duration_s, temp_q_t temp_q, uint32_t epoch);
+
+    /** Perform the scheduled sector erase and flush the RAM queue
+     *
+     * @param busy  true while a pump step is active, the erase is postponed
+     */
+    void service(bool busy);
+
+    /** Number of records stored in flash */
+    uint32_t count() const;
+
+    /** Read back record by index, 0 is the oldest one
+     *
+     * @returns 0 on success, -1 index out of range, -2 record corrupted
+     */
+    int read(uint32_t index, history_record_t *rec);
+
+    /** Records dropped because the RAM queue overflowed */
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    int program_record(history_record_t *rec);
+    uint32_t slot_addr(uint32_t slot) const;
+    uint32_t read_seq(uint32_t slot);
+    void schedule_erase_ahead(void);
+    void find_oldest(int after_sector);
+    static uint16_t checksum(const history_record_t *rec);
+
+    FlashIAP _flash;
+    mutable PlatformMutex _mutex;
+    bool _ready;
+
+    uint32_t _base;             // address of the first reserved sector
+    uint32_t _sector_size;
+    uint32_t _slots_per_sector;
+    uint32_t _total_slots;
+
+    uint32_t _head;             // next slot to be programmed
+    uint32_t _next_seq;
+    uint32_t _oldest_slot;
+    uint32_t _oldest_seq;
+    int _erase_pending;         // sector index waiting for erase, -1 none
+
+    history_record_t _pending[HISTORY_LOG_PENDING];
+    uint8_t _pending_first;
+    uint8_t _pending_count;
+    uint32_t _dropped;
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: loop_stats.cpp
+ *
+ * __Description:__
+ * main loop period / heartbeat jitter histograms, see loop_stats.h
+ *******************************************************************************/
+
+#include "loop_stats.h"
+#include "mbed.h"
+#include "hal/us_ticker_api.h"
+
+static LatencyHist loop_hist;
+static LatencyHist hb_hist;
+
+static uint32_t loop_overrun_us;
+static uint32_t hb_period_us;
+static uint32_t hb_overrun_us;
+
+static uint32_t loop_last_us;
+static uint32_t hb_last_us;
+static bool loop_started = false;
+static bool hb_started = false;
+
+static uint32_t loop_overruns = 0;
+static uint32_t hb_overruns = 0;
+
+static uint32_t boot_start_us;
+static uint32_t boot_ready_us = 0;
+
+/**********************************************************************
+* Function: bucket
+* Parameters: us - sample
+* Returns: histogram index
+*
+* Description: values below 2 * LAT_HIST_SUB get a bucket each, above
+* that the top LAT_HIST_SUB_BITS + 1 bits select the bucket
+**********************************************************************/
+int LatencyHist::bucket(uint32_t us) {
+    if (us > LAT_HIST_MAX_US) {
+        return LAT_HIST_BUCKETS - 1;
+    }
+    if (us < (2 * LAT_HIST_SUB)) {
+        return us;
+    }
+    int msb = 31 - __builtin_clz(us);
+    return ((msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB) + ((us >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB - 1));
+}
+
+uint32_t LatencyHist::bucket_top(int index) {
+    if (index < (2 * LAT_HIST_SUB)) {
+        return index;
+    }
+    int msb = (index / LAT_HIST_SUB) + LAT_HIST_SUB_BITS - 1;
+    uint32_t step = 1ul << (msb - LAT_HIST_SUB_BITS);
+    return ((LAT_HIST_SUB + (index % LAT_HIST_SUB)) * step) + step - 1;
+}
+
+void LatencyHist::record(uint32_t us) {
+    _bins[bucket(us)]++;
+    _count++;
+    if (us > _max) {
+        _max = us;
+    }
+}
+
+void LatencyHist::reset(void) {
+    for (int i = 0; i < LAT_HIST_BUCKETS; i++) {
+        _bins[i] = 0;
+    }
+    _count = 0;
+    _max = 0;
+}
+
+uint32_t LatencyHist::percentile(uint32_t per_mille) const {
+    if (_count == 0) {
+        return 0;
+    }
+
+    uint32_t rank = (((uint64_t)_count * per_mille) + 999) / 1000;
+    uint32_t seen = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += _bins[i];
+        if (seen >= rank) {
+            // the bucket bound can overshoot the biggest sample
+            uint32_t top = bucket_top(i);
+            return (top < _max) ? top : _max;
+        }
+    }
+    return _max;
+}
+
+void loop_stats_init(uint32_t loop_delay_ms, uint32_t heartbeat_ms) {
+    loop_overrun_us = 2 * loop_delay_ms * 1000;
+    hb_period_us = heartbeat_ms * 1000;
+    // the heartbeat is checked once per loop, up to one period late is normal
+    hb_overrun_us = 2 * loop_delay_ms * 1000;
+}
+
+void loop_stats_boot_start(void) {
+    boot_start_us = us_ticker_read();
+}
+
+void loop_stats_boot_ready(void) {
+    boot_ready_us = us_ticker_read() - boot_start_us;
+    printf("boot: control ready after %lu us\r\n", (unsigned long)boot_ready_us);
+}
+
+void loop_stats_iteration(void) {
+    uint32_t now = us_ticker_read();
+
+    if (loop_started) {
+        uint32_t period = now - loop_last_us;
+        loop_hist.record(period);
+        if (period > loop_overrun_us) {
+            loop_overruns++;
+        }
+    }
+    loop_last_us = now;
+    loop_started = true;
+}
+
+void loop_stats_heartbeat(void) {
+    uint32_t now = us_ticker_read();
+
+    if (hb_started) {
+        uint32_t period = now - hb_last_us;
+        // HAL tick vs us ticker rounding can make it a hair early
+        uint32_t late = (period > hb_period_us) ? (period - hb_period_us) : 0;
+        hb_hist.record(late);
+        if (late > hb_overrun_us) {
+            hb_overruns++;
+        }
+    }
+    hb_last_us = now;
+    hb_started = true;
+}
+
+static void print_hist(const char *name, const LatencyHist *p_hist, uint32_t overruns, uint32_t limit_us) {
+    printf("%s: %lu samples, p50 %lu us, p90 %lu us, p99 %lu us, p99.9 %lu us, max %lu us\r\n", name,
+            (unsigned long)p_hist->count(), (unsigned long)p_hist->percentile(500),
+            (unsigned long)p_hist->percentile(900), (unsigned long)p_hist->percentile(990),
+            (unsigned long)p_hist->percentile(999), (unsigned long)p_hist->max());
+    printf("%s: %lu overruns > %lu us\r\n", name, (unsigned long)overruns, (unsigned long)limit_us);
+}
+
+void loop_stats_report(void) {
+    printf("boot: control ready after %lu us\r\n", (unsigned long)boot_ready_us);
+    print_hist("loop period", &loop_hist, loop_overruns, loop_overrun_us);
+    print_hist("heartbeat late", &hb_hist, hb_overruns, hb_overrun_us);
+}
+
+void loop_stats_reset(void) {
+    loop_hist.reset();
+    hb_hist.reset();
+    loop_overruns = 0;
+    hb_overruns = 0;
+    loop_started = false;
+    hb_started = false;
+}
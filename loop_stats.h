@@ -0,0 +1,81 @@
+#ifndef __LOOP_STATS_H__
+#define __LOOP_STATS_H__
+
+#include <cstdint>
+
+/*
+ * Main loop timing.
+ * - every iteration the time since the previous one goes into a histogram,
+ *   an iteration whose work took longer than the MAIN_LOOP_DELAY_MS sleep
+ *   (period > 2 * delay) counts as loop overrun
+ * - every heartbeat the delay past HBLED_TIME_MS goes into a second histogram,
+ *   a heartbeat later than two loop periods counts as heartbeat overrun, that
+ *   is where the once per second RTC/trigger check starts to drift
+ * Buckets are logarithmic with 4 sub-buckets per power of two, so a
+ * percentile is exact to 25% from 1us up to LAT_HIST_MAX_US.
+ * Time base is the us ticker, it stops in deep sleep (locked by adc_scan).
+ * Also measures main() entry to control ready (mbed boot code before main()
+ * not included).
+ */
+
+// 4 sub-buckets per octave
+#define LAT_HIST_SUB_BITS   2
+#define LAT_HIST_SUB        (1 << LAT_HIST_SUB_BITS)
+// highest octave, 2^24 us = 16.7s, longer samples land in the last bucket
+#define LAT_HIST_MAX_MSB    24
+#define LAT_HIST_BUCKETS    ((LAT_HIST_MAX_MSB - LAT_HIST_SUB_BITS + 2) * LAT_HIST_SUB)
+#define LAT_HIST_MAX_US     ((1ul << (LAT_HIST_MAX_MSB + 1)) - 1)
+
+/** Log bucketed histogram of durations in us */
+class LatencyHist {
+public:
+    LatencyHist() { reset(); }
+
+    void record(uint32_t us);
+    void reset(void);
+
+    /** Upper bound of the bucket holding the given percentile
+     *
+     * @param per_mille  0..1000, e.g. 990 for p99
+     * @returns us, 0 when nothing was recorded
+     */
+    uint32_t percentile(uint32_t per_mille) const;
+
+    uint32_t count(void) const { return _count; }
+    uint32_t max(void) const { return _max; }
+
+private:
+    static int bucket(uint32_t us);
+    static uint32_t bucket_top(int index);
+
+    uint32_t _bins[LAT_HIST_BUCKETS];
+    uint32_t _count;
+    uint32_t _max;
+};
+
+/** Set the nominal timing the overruns are counted against
+ *
+ * @param loop_delay_ms  sleep at the end of every iteration (MAIN_LOOP_DELAY_MS)
+ * @param heartbeat_ms   heartbeat period (HBLED_TIME_MS)
+ */
+void loop_stats_init(uint32_t loop_delay_ms, uint32_t heartbeat_ms);
+
+/** Call first thing in main(), start of the boot time measurement */
+void loop_stats_boot_start(void);
+
+/** Call when the control loop is about to run its first iteration */
+void loop_stats_boot_ready(void);
+
+/** Call once at the top of every main loop iteration */
+void loop_stats_iteration(void);
+
+/** Call when the heartbeat fires */
+void loop_stats_heartbeat(void);
+
+/** Print percentiles and overruns to stdout */
+void loop_stats_report(void);
+
+/** Clear the histograms, call from the context of loop_stats_iteration() */
+void loop_stats_reset(void);
+
+#endif
@@ -23,6 +23,7 @@
  *******************************************************************************/
 
 #include "mbed.h"
+#include "hal/us_ticker_api.h"
 #include <cstdint>
 #include <cstdio>
 
@@ -30,6 +31,16 @@
 #include "ds3231.h"
 
 #include "main_types.h"
+#include "board_traits.h"
+#include "history_log.h"
+#include "adc_scan.h"
+#include "pump_guard.h"
+#include "pump_bus_serial.h"
+#include "mem_stats.h"
+#include "loop_stats.h"
+#include "temp_stats.h"
+#include "config_store.h"
+#include "schedule.h"
 
 #define VERSION_MAJOR 2
 #define VERSION_MINOR 5
@@ -50,10 +61,52 @@
 #define HW_ECHO_ENABLED 1
 #define HW_RX_RINGBUFFER_SIZE  128
 
+//pump slot sharing with other controllers on the hw serial bus (pump_bus.h)
+//unique per controller, 0 = standalone, no slot leasing (bus UART and DE pin stay free)
+#ifndef PUMP_BUS_NODE_ID
+#define PUMP_BUS_NODE_ID 0
+#endif
+//give up the cycle when the slot is not granted in time
+#define PUMP_BUS_WAIT_MAX_S (30*60)
+
+#define CONSOLE_LINE_SIZE 32
+
+//a schedule event seen later than this (clock set forward, long stall) is
+//dropped and the next one looked up, missed slots are not run in a batch
+#define SCHED_LATE_MAX_S    120
+//menu "run in 10s"
+#define MANUAL_DELAY_S      10
+
+//the CMake option picks the mbed-os library, the app config the rtos settings,
+//both have to agree (-DSUIJIN_RTOS=ON goes with --app-config mbed_app_rtos.json)
+#if defined(SUIJIN_RTOS)
+#if SUIJIN_RTOS && !MBED_CONF_RTOS_PRESENT
+#error "SUIJIN_RTOS=ON needs --app-config mbed_app_rtos.json"
+#elif !SUIJIN_RTOS && MBED_CONF_RTOS_PRESENT
+#error "mbed_app_rtos.json needs -DSUIJIN_RTOS=ON"
+#endif
+#endif
+
+#if MBED_CONF_RTOS_PRESENT
+//RTOS build: pump control must not wait for the LCD or the console
+#define CONTROL_THREAD_PRIO     osPriorityAboveNormal
+#define DISPLAY_THREAD_PRIO     osPriorityBelowNormal
+#define COMMS_THREAD_PRIO       osPriorityLow
+#define CONTROL_STACK_SIZE      3072
+#define DISPLAY_STACK_SIZE      2048
+#define COMMS_STACK_SIZE        3072
+#define BTN_POLL_MS             MAIN_LOOP_DELAY_MS
+#define CONSOLE_POLL_MS         20
+#define UI_MAIL_DEPTH           4
+#endif
+
 //¬24h (60*60*24 * 1000)
 #define DAY_IN_MS 86400000
 //86400000 
 
+//the values below are the defaults of the runtime config (app_config_t),
+//"cfg" on the console changes them, "cfg save" keeps them in flash
+
 //first loop from POR
 #define FIRST_LOOP 10
 #define PAUSE_TIME 2
@@ -61,33 +114,57 @@
 #define B_RUNTIME_KVETINAC 10
 #define C_RUNTIME_12VPUMP 50
 
-// Standardized LED and button names
-#define LED1_PIN        PC_13   // blackpill on-board led
-#define RED_LED_PIN     PC_8
-#define WHITE_LED_PIN   PC_6
-#define GREEN_LED_PIN   PB_7
-#define BLUE_LED_PIN    PB_8
-#define BIGPUMP12V_EN_PIN    PC_4
-
-#define FAN_EN_PIN    PB_15
-
-// #define HW_SERIAL_TX_PIN PA_2
-// #define HW_SERIAL_RX_PIN PA_3
-
-#define SELECT_BTN_PIN  PA_15
-#define ENTER_BTN_PIN   PB_5
-
-
-
-DigitalOut red_led(RED_LED_PIN);
-DigitalOut blue_led(BLUE_LED_PIN);
-
-DigitalIn btn_select(SELECT_BTN_PIN);
-DigitalIn btn_enter(ENTER_BTN_PIN);
-DigitalOut motor_A(GREEN_LED_PIN); //stromecek
-DigitalOut motor_B(WHITE_LED_PIN); //kvetinace
-DigitalOut big_pump_12V(BIGPUMP12V_EN_PIN); //12v pump for big manifold
-DigitalOut fan_en(FAN_EN_PIN);
+//default schedule, every day, all zones
+#define SCHED_DEFAULT_AM_H  8
+#define SCHED_DEFAULT_PM_H  21
+
+//runtimes above are for a typical day, they scale with the heat since the last cycle
+//degC*h above TEMP_STATS_BASE_Q between two cycles that give 100% runtime
+#define TEMP_DH_REF_CH          60
+//degC*h -> 1/4 degC * s
+#define TEMP_DH_CH_TO_Q_S       (4 * 3600)
+//first cycle after boot: degree-hours since boot are extrapolated to the
+//usual cycle distance, with less than TEMP_DH_MIN_S of data runtimes stay at 100%
+#define TEMP_CYCLE_NOMINAL_S    (12*60*60)
+#define TEMP_DH_MIN_S           (60*60)
+//how strongly each zone follows the heat, 100 = proportional, 0 = fixed runtime
+#define TEMP_GAIN_12V           100
+#define TEMP_GAIN_A             100
+#define TEMP_GAIN_B             100
+#define TEMP_SCALE_MIN_PCT      50
+#define TEMP_SCALE_MAX_PCT      200
+
+//soil moisture, raw 12-bit adc, capacitive probes read lower when wet
+//zone is skipped when the reading is below its wet level
+#define MOIST_WET_LEVEL_12V 1800
+#define MOIST_WET_LEVEL_A   1800
+#define MOIST_WET_LEVEL_B   1800
+//readings outside this window = probe missing/shorted, zone is wattered as scheduled
+#define MOIST_PROBE_MIN     100
+#define MOIST_PROBE_MAX     4000
+
+//pump shunt current bands, raw 12-bit adc (see pump_guard.h), 0 = check off
+//boards without shunts (Board::PUMP_SHUNTS) start with the guard off
+//                          open  dry   stall
+#define PUMP_LIMITS_12V     {  80,  600, 3500 }
+#define PUMP_LIMITS_A       {  40,  250, 2000 }
+#define PUMP_LIMITS_B       {  40,  250, 2000 }
+
+//fan hysteresis
+#define FAN_ON_TEMP_Q   TEMP_C_TO_Q(34)
+#define FAN_OFF_TEMP_Q  TEMP_C_TO_Q(28)
+
+// pin map and board resources -> board_traits.h
+
+DigitalOut red_led(Board::RED_LED_PIN);
+DigitalOut blue_led(Board::BLUE_LED_PIN);
+
+DigitalIn btn_select(Board::SELECT_BTN_PIN);
+DigitalIn btn_enter(Board::ENTER_BTN_PIN);
+DigitalOut motor_A(Board::PUMP_A_PIN); //stromecek
+DigitalOut motor_B(Board::PUMP_B_PIN); //kvetinace
+DigitalOut big_pump_12V(Board::PUMP_12V_PIN); //12v pump for big manifold
+DigitalOut fan_en(Board::FAN_EN_PIN);
 /*---------------------------*/
 
 bool flag_wattering_in_progress = false;
@@ -95,27 +172,138 @@ e_MENU_SCREEN gl_menu_screen = e_MENU_SCREEN::ScrHome;
 
 
 // SDA // SCL // addr // type           
-TextLCD lcd(PA_10, PA_9, 0x4E, TextLCD::LCD16x2);
+TextLCD lcd(Board::I2C_SDA_PIN, Board::I2C_SCL_PIN, 0x4E, TextLCD::LCD16x2);
 
 //rtc object
-Ds3231 rtc(PA_10, PA_9);
-
-float rtcTempC = -120;
+Ds3231 rtc(Board::I2C_SDA_PIN, Board::I2C_SCL_PIN);
+
+temp_q_t rtcTempQ = TEMP_C_TO_Q(-120);
+
+//runtime config, flash copy in the two sectors below the history log
+ConfigStore cfg_store;
+app_config_t cfg;
+TempStats temp_stats;
+
+//wattering history in internal flash
+HistoryLog history;
+
+//pump slot leasing between controllers
+#if PUMP_BUS_NODE_ID != 0
+SerialBusPort bus_port(Board::BUS_TX_PIN, Board::BUS_RX_PIN, Board::BUS_DE_PIN, HW_SERIAL_BAUDRATE);
+#else
+PumpBusNullPort bus_port;
+#endif
+PumpBus bus(&bus_port, PUMP_BUS_NODE_ID);
+
+static const uint8_t moist_slot[ZoneCount] = { AdcMoist12V, AdcMoistA, AdcMoistB };
+
+static DigitalOut *const pump_out[ZoneCount] = { &big_pump_12V, &motor_A, &motor_B };
+static const pump_limits_t pump_limits_default[ZoneCount] = { PUMP_LIMITS_12V, PUMP_LIMITS_A, PUMP_LIMITS_B };
+
+//runtimes of the running cycle
+static uint16_t zone_runtime[ZoneCount];
+
+//weekly schedule, edited in the control context (RTOS: console edits are
+//forwarded to control_task) which then sets sched_changed,
+//next_event is owned by control and moved on with Schedule::advance()
+Schedule schedule;
+static sched_event_t next_event;
+static bool next_valid = false;
+static volatile bool sched_changed = true;
+static uint32_t manual_epoch = 0;
+//zones of the triggering event and of the running cycle
+static uint8_t trigger_zone_mask = 0;
+static uint8_t cycle_zone_mask = SCHED_ZONES_ALL;
+
+static const char *const day_name[7] = { "Su", "Mo", "Tu", "We", "Th", "Fr", "Sa" };
+
+//console access to the runtime config
+typedef struct {
+    const char *name;
+    void *p_value;          // uint16_t, temp_q_t when temp
+    uint8_t count;          // 1 or one value per e_ZONE
+    uint8_t stride;         // bytes from one zone value to the next
+    bool temp;              // entered/shown in degC
+    int32_t min;
+    int32_t max;
+} cfg_item_t;
+
+#define CFG_ARRAY   sizeof(uint16_t)
+#define CFG_LIMITS  sizeof(pump_limits_t)
+
+static const cfg_item_t cfg_items[] = {
+    { "run",    cfg.runtime_s,                      ZoneCount,  CFG_ARRAY,  false,  1,      3600 },
+    { "pause",  &cfg.pause_s,                       1,          CFG_ARRAY,  false,  0,      600 },
+    { "wet",    cfg.moist_wet_level,                ZoneCount,  CFG_ARRAY,  false,  0,      4095 },
+    { "fanon",  &cfg.fan_on_q,                      1,          CFG_ARRAY,  true,   -40,    85 },
+    { "fanoff", &cfg.fan_off_q,                     1,          CFG_ARRAY,  true,   -40,    85 },
+    { "gain",   cfg.temp_gain,                      ZoneCount,  CFG_ARRAY,  false,  0,      400 },
+    { "heat",   &cfg.temp_dh_ref_ch,                1,          CFG_ARRAY,  false,  1,      1000 },
+    { "open",   &cfg.pump_limits[0].open_below,     ZoneCount,  CFG_LIMITS, false,  0,      4095 },
+    { "dry",    &cfg.pump_limits[0].dry_below,      ZoneCount,  CFG_LIMITS, false,  0,      4095 },
+    { "stall",  &cfg.pump_limits[0].stall_above,    ZoneCount,  CFG_LIMITS, false,  0,      4095 },
+};
+#define CFG_ITEM_COUNT (sizeof(cfg_items) / sizeof(cfg_items[0]))
+
+#if MBED_CONF_RTOS_PRESENT
+//control -> display, once per heartbeat
+typedef struct {
+    ds3231_time_t now;
+    sched_event_t next;
+    bool next_valid;
+} display_msg_t;
+
+//display -> control, menu action; comms -> control, console line editing
+//the schedule or the whole config
+typedef struct {
+    e_UI_ACTION action;
+    char line[CONSOLE_LINE_SIZE];   // UiConsoleCmd only
+} ui_cmd_t;
+
+Mail<display_msg_t, UI_MAIL_DEPTH> display_mail;
+Mail<ui_cmd_t, UI_MAIL_DEPTH> ui_cmd_mail;
+
+Thread control_thread(CONTROL_THREAD_PRIO, CONTROL_STACK_SIZE, NULL, "control");
+Thread display_thread(DISPLAY_THREAD_PRIO, DISPLAY_STACK_SIZE, NULL, "display");
+Thread comms_thread(COMMS_THREAD_PRIO, COMMS_STACK_SIZE, NULL, "comms");
+#endif
 
 void btn_debounce(unsigned char sel_read, unsigned char enter_read, bool * sel_out, bool * enter_out);
 void get_user_input(char* message, uint8_t min, uint8_t max, uint32_t* member);
 void get_user_input(char* message, uint8_t min, uint8_t max, bool* member);
-int compare_times(ds3231_time_t *p_tA, ds3231_time_t *p_tB);
-void add2times(ds3231_time_t *p_target, uint32_t h_add, uint32_t m_add, uint32_t s_add);
 void process_state(e_EVENT event);
-void process_fan(float temp);
-void update_screen(e_BTN_EVENT btn_input, ds3231_time_t *p_now, ds3231_time_t *p_target );
-void set_next_time(ds3231_time_t *p_target);
+void process_fan(temp_q_t temp_q);
+e_UI_ACTION update_screen(e_BTN_EVENT btn_input, ds3231_time_t *p_now, const sched_event_t *p_next);
+void control_service(void);
+void control_heartbeat(ds3231_time_t *p_now);
+void control_ui_action(e_UI_ACTION action);
+uint8_t schedule_check(uint32_t now_epoch);
+void poll_console(void);
+void process_console_cmd(char *line);
+void process_sched_cmd(char *arg);
+bool forward_to_control(const char *cmd, const char *arg);
+bool zone_is_wet(int zone);
+bool skip_zone(e_ZONE zone, temp_q_t temp_q, time_t time_now);
+uint32_t temp_heat_pct(void);
+void update_zone_runtimes(void);
+#if MBED_CONF_RTOS_PRESENT
+void control_task(void);
+void display_task(void);
+void display_input(e_BTN_EVENT btn_input, ds3231_time_t *p_now, const sched_event_t *p_next);
+void comms_task(void);
+#endif
+void print_history(uint32_t first, uint32_t n);
+void config_defaults(app_config_t *p_cfg);
+void config_load(void);
+void process_cfg_cmd(char *arg);
 
 
 int main()
 {
    // hwserial.attach(&rxhandler_hwserial, SerialBase::RxIrq);
+    loop_stats_boot_start();
+    mem_stats_init();
+
     unsigned int loopCount = 0;
     unsigned int heartbeatTime = 0;
     
@@ -135,6 +323,10 @@ int main()
     motor_B.write(MOTOR_DISABLE);
     fan_en.write(MOTOR_DISABLE);
 
+    //both objects share the bus, mbed I2C reapplies the speed of the active owner
+    lcd.frequency(Board::I2C_HZ);
+    rtc.frequency(Board::I2C_HZ);
+
     //DS3231 rtc variables
 
     //default, use bit masks in ds3231.h for desired operation
@@ -142,11 +334,23 @@ int main()
     ds3231_time_t rtc_time;
     ds3231_calendar_t rtc_calendar;
 
-    lcd.printf("Suijin v%d.%d\ninitializing...", VERSION_MAJOR, VERSION_MINOR);
+    //LCD comes up on the first screen update, after control is running
 
-            
     rtc.set_cntl_stat_reg(rtc_control_status);
 
+    config_load();
+
+    if (history.init() != 0) {
+        printf("HLog: init failed, history disabled\r\n");
+    }
+    history.append(HistBoot, ZoneNone, 0, 0, rtc.get_epoch());
+    printf("HLog: %lu records\r\n", (unsigned long)history.count());
+
+    pump_guard_init(pump_out, cfg.pump_limits);
+    if (adc_scan_init() != 0) {
+        printf("ADC: init failed, moisture check and pump guard disabled\r\n");
+    }
+
 
 #ifdef FORCE_TIME_SETUP_MANUAL
     //get day from user
@@ -202,12 +406,6 @@ int main()
     char buffer[32];
     ds3231_time_t gl_time;
 
-    ds3231_time_t next_wattering_time;
-
-    next_wattering_time.hours = 23;
-    next_wattering_time.minutes = 12;
-    next_wattering_time.seconds = 35;
-
     bool trigger_manual;
 
     bool input_select, input_enter;
@@ -219,79 +417,72 @@ int main()
     input_enter = 0;
 
     int count=0;
-    
-    e_EVENT main_event = e_EVENT::EventNone;
 
     rtc.get_time(&gl_time);
-    next_wattering_time = gl_time;
-    set_next_time(&next_wattering_time);
 
-    if (compare_times(&gl_time, &next_wattering_time) == 1) {
-        add2times(&next_wattering_time, 2, 0, 0);
-    }
+    printf("-- init done --\r\n");
 
-    HAL_Delay(2000);
-    lcd.cls();
-    //lcd.locate(1,2);
+    loop_stats_init(MAIN_LOOP_DELAY_MS, HBLED_TIME_MS);
 
-    printf("-- init done --\r\n");
+#if MBED_CONF_RTOS_PRESENT
+    control_thread.start(control_task);
+    display_thread.start(display_task);
+    comms_thread.start(comms_task);
+    control_thread.join();
+#else
+    loop_stats_boot_ready();
 
     while (true)
     {
         timenow = HAL_GetTick();
+        loop_stats_iteration();
 
         btn_debounce(btn_select.read(), btn_enter.read(), &input_select, &input_enter);
         //trigger_manual = button.read();
 
-        main_event = e_EVENT::EventNone;
+        control_service();
 
         if ((timenow - heartbeatTime) > HBLED_TIME_MS ) {
-            red_led = !red_led;
             heartbeatTime = timenow;
 
-            rtc.get_time(&gl_time);
+            control_heartbeat(&gl_time);
 
-            update_screen(e_BTN_EVENT::BtnNone, &gl_time, &next_wattering_time);
+            MEM_SITE_BEGIN(MemSiteUpdateScreen);
+            update_screen(e_BTN_EVENT::BtnNone, &gl_time, next_valid ? &next_event : NULL);
+            MEM_SITE_END(MemSiteUpdateScreen);
             
             //printf("select debug: %d\r\n", btn_select.read());
-
-            lcd.locate(15,1);
-            if (compare_times(&gl_time, &next_wattering_time) == 0) { //gl_time has passed the wattering time
-                blue_led.write(true);
-                main_event = e_EVENT::EventTriggerWattering;
-                
-                set_next_time(&next_wattering_time);
-
-            } else {
-                blue_led.write(false);
-            }
-
-            rtcTempC = ((rtc.get_temperature()>>6) / 4.0);
-            process_fan(rtcTempC);
-
-            process_state(main_event);
             HAL_Delay(5);
             //new epoch time fx
         }
 
+        poll_console();
+
         if ((previous_enter != input_enter)) {
             previous_enter = input_enter;
             printf("ENTER: %d\n",input_enter);
             //enter pressed
-            if (input_enter==1)
-                update_screen(e_BTN_EVENT::BtnPressedEnter, &gl_time, &next_wattering_time);
+            if (input_enter==1) {
+                MEM_SITE_BEGIN(MemSiteUpdateScreen);
+                control_ui_action(update_screen(e_BTN_EVENT::BtnPressedEnter, &gl_time, next_valid ? &next_event : NULL));
+                MEM_SITE_END(MemSiteUpdateScreen);
+            }
         }
         if (previous_select != input_select) {
             previous_select = input_select;
             printf("SELECT: %d\n",input_select);
             //select pressed
-            if (input_select==1)
-                update_screen(e_BTN_EVENT::BtnPressedSelect, &gl_time, &next_wattering_time);
+            if (input_select==1) {
+                MEM_SITE_BEGIN(MemSiteUpdateScreen);
+                control_ui_action(update_screen(e_BTN_EVENT::BtnPressedSelect, &gl_time, next_valid ? &next_event : NULL));
+                MEM_SITE_END(MemSiteUpdateScreen);
+            }
         }
 
-        HAL_Delay(MAIN_LOOP_DELAY_MS);
+        thread_sleep_for(MAIN_LOOP_DELAY_MS);
         loopCount++;
     }
+#endif
 }
 
 
@@ -333,6 +524,7 @@ void get_user_input(char* message, uint8_t min, uint8_t max, uint32_t* member)
 {
     uint32_t temp;
 
+    MEM_SITE_BEGIN(MemSiteUserInput);
     do
     {
         printf("\n%s", message);
@@ -349,6 +541,7 @@ void get_user_input(char* message, uint8_t min, uint8_t max, uint32_t* member)
         }
     }
     while((*(member) < min) || (*(member) > max));
+    MEM_SITE_END(MemSiteUserInput);
 }
 
 
@@ -356,6 +549,7 @@ void get_user_input(char* message, uint8_t min, uint8_t max, bool* member)
 {
     uint32_t temp;
 
+    MEM_SITE_BEGIN(MemSiteUserInput);
     do
     {
         printf("\n%s", message);
@@ -372,69 +566,7 @@ void get_user_input(char* message, uint8_t min, uint8_t max, bool* member)
         }
     }
     while((*(member) < min) || (*(member) > max));
-}
-
-/**********************************************************************
-* Function: compare_times
-* Parameters: ds3231_time_t *A
-*             ds3231_time_t *B
-* Returns: int
-*
-* Description: compares 2 times
-* -- if A > B (A is later in the day than B), returns 1
-* -- if A = B (A is same time as B), returns 0
-* -- if A < B (B is later in the day than A), returns -1
-*
-* TODO: add support for different modes, function now assumes same format on both parameters
-* TODO: add error detection on "impossible time"
-**********************************************************************/
-
-int compare_times(ds3231_time_t *p_tA, ds3231_time_t *p_tB) {
-
-    if ( p_tA->hours > p_tB->hours) return 1;
-    if ( p_tA->hours < p_tB->hours) return -1;
-
-    // now hours can be assumed equal
-    if ( p_tA->minutes > p_tB->minutes) return 1;
-    if ( p_tA->minutes < p_tB->minutes) return -1;
-
-    // now hours&minutes can be assumed equal
-    if ( p_tA->seconds > p_tB->seconds) return 1;
-    if ( p_tA->seconds < p_tB->seconds) return -1;
-
-//all is equal
-return 0;
-}
-
-/**********************************************************************
-* Function: add2times
-* Parameters: ds3231_time_t *target
-*             ds3231_time_t offset
-* Returns: --
-*
-* Description: adds offset time to the target, wraps values around
-*
-* TODO: add support for am/pm modes
-**********************************************************************/
-void add2times(ds3231_time_t *p_target, uint32_t h_add, uint32_t m_add, uint32_t s_add) {
-
-    p_target->seconds += s_add;
-    if (p_target->seconds > 59) {
-        p_target->seconds = p_target->seconds%60;
-        m_add += 1;
-    };
-
-    p_target->minutes += m_add;
-    if (p_target->minutes > 59) {
-        p_target->minutes = p_target->minutes%60;
-        h_add += 1;
-    };
-
-    p_target->hours += h_add;
-    if (p_target->hours > 23) {
-        p_target->hours = p_target->hours%24;
-    };
-
+    MEM_SITE_END(MemSiteUserInput);
 }
 
 
@@ -442,66 +574,114 @@ void process_state(e_EVENT event) {
     static e_SUIJIN_STATE state = e_SUIJIN_STATE::WaitingForNextCycle;
 
     static time_t time_transition = 0;
+    static time_t time_step_start = 0;
+    static time_t time_cycle_start = 0;
 
     time_t time_now = rtc.get_epoch();
+    temp_q_t temp_q = rtcTempQ;
+
+    if (event == e_EVENT::EventStopCmd) {
+        for (int zone = 0; zone < ZoneCount; zone++) {
+            pump_guard_set(zone, false);
+            e_PUMP_FAULT fault = pump_guard_fault(zone);
+            if (fault != PumpFaultNone) {
+                history.append(HistPumpOpen + (fault - PumpFaultOpen), zone, time_now - time_step_start, temp_q, time_now);
+                printf("SMinf: pump %d fault %d (level %u)\r\n", zone, fault, pump_guard_level(zone));
+            }
+        }
+        pump_guard_clear();
+        if (state == e_SUIJIN_STATE::WaitingForSlot) {
+            bus.release(HAL_GetTick());
+            state = e_SUIJIN_STATE::WaitingForNextCycle;
+        }
+        if (state != e_SUIJIN_STATE::WaitingForNextCycle) {
+            state = e_SUIJIN_STATE::Appendix;
+            printf("SMinf: Stop\r\n");
+        }
+    }
 
     switch (state) {
         case e_SUIJIN_STATE::InitSetup:
-            time_transition = time_now + C_RUNTIME_12VPUMP;
-            state = e_SUIJIN_STATE::RunningPump_12V;
             flag_wattering_in_progress = true;
             fan_en.write(MOTOR_ENABLE);
+            time_cycle_start = time_now;
+            update_zone_runtimes();
+            temp_stats.cycle_start();
+            history.append(HistCycleStart, ZoneNone, 0, temp_q, time_now);
             printf("SMinf: Exit InitSetup\r\n");
+            if (skip_zone(Zone12V, temp_q, time_now)) {
+                time_transition = time_now;
+                state = e_SUIJIN_STATE::Pause_12V;
+                break;
+            }
+            time_transition = time_now + zone_runtime[Zone12V];
+            time_step_start = time_now;
+            state = e_SUIJIN_STATE::RunningPump_12V;
             //break;
 
         case e_SUIJIN_STATE::RunningPump_12V:
-            big_pump_12V.write(MOTOR_ENABLE);
+            pump_guard_set(Zone12V, MOTOR_ENABLE);
             if (time_now > time_transition) {
-                time_transition = time_now + PAUSE_TIME;
+                time_transition = time_now + cfg.pause_s;
                 state = e_SUIJIN_STATE::Pause_12V;
+                history.append(HistPumpRun, Zone12V, time_now - time_step_start, temp_q, time_now);
                 printf("SMinf: Exit Running Pump12V\r\n");
             }
             break;
 
         case e_SUIJIN_STATE::Pause_12V:
-            big_pump_12V.write(MOTOR_DISABLE);
+            pump_guard_set(Zone12V, MOTOR_DISABLE);
             if (time_now > time_transition) {
-                time_transition = time_now + A_RUNTIME_STROMEK;
-                state = e_SUIJIN_STATE::RunningPump_A;
+                if (skip_zone(ZoneA, temp_q, time_now)) {
+                    time_transition = time_now;
+                    state = e_SUIJIN_STATE::Pause_A;
+                } else {
+                    time_transition = time_now + zone_runtime[ZoneA];
+                    time_step_start = time_now;
+                    state = e_SUIJIN_STATE::RunningPump_A;
+                }
                 printf("SMinf: Exit Pause_12V\r\n");
             }
             break;
 
 
         case e_SUIJIN_STATE::RunningPump_A:
-            motor_A.write(MOTOR_ENABLE);
+            pump_guard_set(ZoneA, MOTOR_ENABLE);
             if (time_now > time_transition) {
-                time_transition = time_now + PAUSE_TIME;
+                time_transition = time_now + cfg.pause_s;
                 state = e_SUIJIN_STATE::Pause_A;
+                history.append(HistPumpRun, ZoneA, time_now - time_step_start, temp_q, time_now);
                 printf("SMinf: Exit Running PumpA\r\n");
             }
             break;
 
         case e_SUIJIN_STATE::Pause_A:
-            motor_A.write(MOTOR_DISABLE);
+            pump_guard_set(ZoneA, MOTOR_DISABLE);
             if (time_now > time_transition) {
-                time_transition = time_now + B_RUNTIME_KVETINAC;
-                state = e_SUIJIN_STATE::RunningPump_B;
+                if (skip_zone(ZoneB, temp_q, time_now)) {
+                    time_transition = time_now;
+                    state = e_SUIJIN_STATE::Pause_B;
+                } else {
+                    time_transition = time_now + zone_runtime[ZoneB];
+                    time_step_start = time_now;
+                    state = e_SUIJIN_STATE::RunningPump_B;
+                }
                 printf("SMinf: Exit Pause_A\r\n");
             }
             break;
 
         case e_SUIJIN_STATE::RunningPump_B:
-            motor_B.write(MOTOR_ENABLE);
+            pump_guard_set(ZoneB, MOTOR_ENABLE);
             if (time_now > time_transition) {
-                time_transition = time_now + PAUSE_TIME;
+                time_transition = time_now + cfg.pause_s;
                 state = e_SUIJIN_STATE::Pause_B;
+                history.append(HistPumpRun, ZoneB, time_now - time_step_start, temp_q, time_now);
                 printf("SMinf: Exit Running PumpB\r\n");
             }
             break;
 
         case e_SUIJIN_STATE::Pause_B:
-            motor_B.write(MOTOR_DISABLE);
+            pump_guard_set(ZoneB, MOTOR_DISABLE);
             if (time_now > time_transition) {
                 //time_transition = time_now + PAUSE_TIME;
                 state = e_SUIJIN_STATE::Appendix;
@@ -513,21 +693,53 @@ void process_state(e_EVENT event) {
             state = e_SUIJIN_STATE::WaitingForNextCycle;
             flag_wattering_in_progress = false;
             fan_en.write(MOTOR_DISABLE);
+            bus.release(HAL_GetTick());
+            history.append(HistCycleEnd, ZoneNone, time_now - time_cycle_start, temp_q, time_now);
             printf("SMinf: Exit Appendix\r\n");
             //break;
 
         case e_SUIJIN_STATE::WaitingForNextCycle:
             if (event == e_EVENT::EventTriggerWattering) {
-                state = e_SUIJIN_STATE::InitSetup;
+                cycle_zone_mask = trigger_zone_mask;
+                bool all_wet = true;
+                for (int zone = 0; zone < ZoneCount; zone++) {
+                    if ((cycle_zone_mask & (1 << zone)) && !zone_is_wet(zone)) {
+                        all_wet = false;
+                    }
+                }
+                if (all_wet) {
+                    history.append(HistCycleSkipped, ZoneNone, 0, temp_q, time_now);
+                    printf("SMinf: all zones wet, cycle skipped\r\n");
+                    break;
+                }
+                if (PUMP_BUS_NODE_ID == 0) {
+                    state = e_SUIJIN_STATE::InitSetup;
+                } else {
+                    bus.request(HAL_GetTick());
+                    time_transition = time_now + PUMP_BUS_WAIT_MAX_S;
+                    state = e_SUIJIN_STATE::WaitingForSlot;
+                }
                 printf("SMinf: Exit waiting\r\n");
             }
             break;
+
+        case e_SUIJIN_STATE::WaitingForSlot:
+            if (bus.granted()) {
+                state = e_SUIJIN_STATE::InitSetup;
+                printf("SMinf: Exit WaitingForSlot, slot granted\r\n");
+            } else if (time_now > time_transition) {
+                bus.release(HAL_GetTick());
+                state = e_SUIJIN_STATE::WaitingForNextCycle;
+                history.append(HistSlotTimeout, ZoneNone, PUMP_BUS_WAIT_MAX_S, temp_q, time_now);
+                printf("SMinf: Exit WaitingForSlot, timeout (holder %d)\r\n", bus.holder(HAL_GetTick()));
+            }
+            break;
     };
 
 return;
 }
 
-void process_fan(float tempC) {
+void process_fan(temp_q_t temp_q) {
     bool fstatus = fan_en.read();
     bool ftarget;
 
@@ -535,40 +747,42 @@ void process_fan(float tempC) {
         return;
     }
     ftarget = fstatus;
-    if (tempC > 34.0) {
+    if (temp_q > cfg.fan_on_q) {
         ftarget = MOTOR_ENABLE;
     }
-    if (tempC < 28.0) {
+    if (temp_q < cfg.fan_off_q) {
         ftarget = MOTOR_DISABLE;
     }
 
     if (fstatus != ftarget) {
         fan_en.write(ftarget);
-        printf("Fan updated to: %d at temp %.2f\r\n", ftarget, tempC);
+        history.append(ftarget ? HistFanOn : HistFanOff, ZoneNone, 0, temp_q, rtc.get_epoch());
+        printf("Fan updated to: %d at temp " TEMP_Q_FMT "\r\n", ftarget, TEMP_Q_ARGS(temp_q));
     }
 }
 
-void update_screen(e_BTN_EVENT btn_input, ds3231_time_t *p_now, ds3231_time_t *p_target ) {
+e_UI_ACTION update_screen(e_BTN_EVENT btn_input, ds3231_time_t *p_now, const sched_event_t *p_next) {
     static e_MENU_SCREEN screen_set = e_MENU_SCREEN::ScrHome;
-
-        // if (input_enter) {
-        //     next_wattering_time = gl_time;
-        //     add2times(&next_wattering_time , 0, 0, 21);
-        // }
+    e_UI_ACTION action = e_UI_ACTION::UiNone;
 
     switch (screen_set) {
         case e_MENU_SCREEN::ScrHome:
             lcd.locate(0,0);
             lcd.printf("time: %2d:%02d:%02d  ", p_now->hours, p_now->minutes, p_now->seconds);
             lcd.locate(0,1);
-            lcd.printf("next: %2d:%02d:%02d  ", p_target->hours, p_target->minutes, p_target->seconds);
+            if (p_next != NULL) {
+                uint32_t day_s = p_next->epoch % 86400;
+                lcd.printf("next: %s %2lu:%02lu  ", day_name[Schedule::weekday(p_next->epoch)],
+                        (unsigned long)(day_s / 3600), (unsigned long)((day_s / 60) % 60));
+            } else {
+                lcd.printf("next: --        ");
+            }
 
             if (btn_input == e_BTN_EVENT::BtnPressedEnter) {
                 screen_set = e_MENU_SCREEN::ScrManualTrigger;
             }
             if (btn_input == e_BTN_EVENT::BtnPressedSelect) {
-                //*p_target = *p_now;
-                set_next_time(p_target);
+                action = e_UI_ACTION::UiSkipNext;
             }
             break;
 
@@ -578,10 +792,7 @@ void update_screen(e_BTN_EVENT btn_input, ds3231_time_t *p_now, ds3231_time_t *p
             lcd.locate(0,1);
             lcd.printf("Esc = return    ");
             if (btn_input == e_BTN_EVENT::BtnPressedEnter) {
-                //printf("Manual wattering trig.\r\n");
-                *p_target = *p_now;
-                add2times(p_target , 0, 0, 10);
-                printf("Manual trigger. target-time +=10s\r\n");
+                action = e_UI_ACTION::UiManualRun;
                 screen_set = e_MENU_SCREEN::ScrHome;
             }
             if (btn_input == e_BTN_EVENT::BtnPressedSelect) {
@@ -593,35 +804,827 @@ void update_screen(e_BTN_EVENT btn_input, ds3231_time_t *p_now, ds3231_time_t *p
             break;
     };
 
-    //printf("temperature in C: %.2f\r\n", rtcTempC);
+    //printf("temperature in C: " TEMP_Q_FMT "\r\n", TEMP_Q_ARGS(rtcTempQ));
 
-return;
+return action;
+}
+
+/**********************************************************************
+* Function: control_service
+* Parameters: --
+* Returns: --
+*
+* Description: control work of every loop iteration, pump fault
+* reaction, slot leasing and the history flash upkeep
+**********************************************************************/
+void control_service(void) {
+    //pump output already cut in the ADC interrupt, stop the sequence now
+    if (pump_guard_tripped()) {
+        MEM_SITE_BEGIN(MemSiteProcessState);
+        process_state(e_EVENT::EventStopCmd);
+        MEM_SITE_END(MemSiteProcessState);
+    }
+
+    bus.poll(HAL_GetTick());
+
+    //slot lost mid cycle, only after frames were lost for longer than the
+    //confirm period, the other holder keeps pumping
+    if ((PUMP_BUS_NODE_ID != 0) && flag_wattering_in_progress && !bus.granted()) {
+        printf("bus: slot lost to node %d, cycle stopped\r\n", bus.holder(HAL_GetTick()));
+        MEM_SITE_BEGIN(MemSiteProcessState);
+        process_state(e_EVENT::EventStopCmd);
+        MEM_SITE_END(MemSiteProcessState);
+    }
+
+    //flash erase only between wattering cycles
+    history.service(flag_wattering_in_progress);
+}
+
+/**********************************************************************
+* Function: control_heartbeat
+* Parameters: p_now - filled with the rtc time
+* Returns: --
+*
+* Description: once per HBLED_TIME_MS, wattering trigger, fan and
+* the state machine step
+**********************************************************************/
+void control_heartbeat(ds3231_time_t *p_now) {
+    e_EVENT event = e_EVENT::EventNone;
+
+    red_led = !red_led;
+    loop_stats_heartbeat();
+
+    rtc.get_time(p_now);
+
+    uint8_t zone_mask = schedule_check(rtc.get_epoch());
+    if (zone_mask != 0) {
+        blue_led.write(Board::LED_ON);
+        event = e_EVENT::EventTriggerWattering;
+        trigger_zone_mask = zone_mask;
+    } else {
+        blue_led.write(!Board::LED_ON);
+    }
+
+    //MSB = signed integer part, LSB bits 7:6 = fraction
+    rtcTempQ = ((int16_t)rtc.get_temperature()) >> 6;
+    temp_stats.sample(rtcTempQ, HAL_GetTick());
+    process_fan(rtcTempQ);
+
+    MEM_SITE_BEGIN(MemSiteProcessState);
+    process_state(event);
+    MEM_SITE_END(MemSiteProcessState);
+}
+
+/**********************************************************************
+* Function: schedule_check
+* Parameters: now_epoch - rtc time
+* Returns: zones to water now, 0 = none
+*
+* Description: one compare against the precomputed next event per
+* heartbeat, the table is only searched after an edit or a clock jump
+**********************************************************************/
+uint8_t schedule_check(uint32_t now_epoch) {
+    static uint32_t last_epoch = 0;
+    uint8_t zone_mask = 0;
+
+    //clock set back, even by a minute: events in between would be skipped
+    if (sched_changed || (now_epoch < last_epoch)) {
+        sched_changed = false;
+        next_valid = schedule.find_next(now_epoch, &next_event);
+    }
+    last_epoch = now_epoch;
+
+    if ((manual_epoch != 0) && (now_epoch >= manual_epoch)) {
+        manual_epoch = 0;
+        zone_mask = SCHED_ZONES_ALL;
+    }
+
+    if (!next_valid) {
+        return zone_mask;
+    }
+    if (now_epoch >= next_event.epoch) {
+        if ((now_epoch - next_event.epoch) > SCHED_LATE_MAX_S) {
+            printf("Schedule: clock jumped, event at %lu dropped\r\n", (unsigned long)next_event.epoch);
+            next_valid = schedule.find_next(now_epoch, &next_event);
+        } else {
+            zone_mask |= next_event.zone_mask;
+            next_valid = schedule.advance(&next_event);
+        }
+    }
+    return zone_mask;
+}
+
+/**********************************************************************
+* Function: control_ui_action
+* Parameters: action - from the menu
+* Returns: --
+*
+* Description: runs in the control context, the menu only reports
+**********************************************************************/
+void control_ui_action(e_UI_ACTION action) {
+    switch (action) {
+        case e_UI_ACTION::UiSkipNext:
+            if (next_valid) {
+                next_valid = schedule.advance(&next_event);
+                printf("Schedule: next event skipped\r\n");
+            }
+            break;
+
+        case e_UI_ACTION::UiManualRun:
+            manual_epoch = rtc.get_epoch() + MANUAL_DELAY_S;
+            printf("Manual trigger in %ds\r\n", MANUAL_DELAY_S);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**********************************************************************
+* Function: poll_console
+* Parameters: --
+* Returns: --
+*
+* Description: non-blocking read of the stdio console, collects one line
+* and hands it over to process_console_cmd(). stdio is a BufferedSerial
+* (platform.stdio-buffered-serial), the rx interrupt keeps what is typed
+* or pasted while the LCD update or the comms thread keeps us away.
+**********************************************************************/
+void poll_console(void) {
+    static char line[CONSOLE_LINE_SIZE];
+    static unsigned int len = 0;
+
+    FileHandle *console = mbed_file_handle(STDIN_FILENO);
+    char c;
+
+    while (console->readable()) {
+        if (console->read(&c, 1) != 1) {
+            return;
+        }
+        if ((c == '\r') || (c == '\n')) {
+            if (len > 0) {
+                line[len] = 0;
+                MEM_SITE_BEGIN(MemSiteConsole);
+                process_console_cmd(line);
+                MEM_SITE_END(MemSiteConsole);
+                len = 0;
+            }
+        } else if (len < (CONSOLE_LINE_SIZE - 1)) {
+            line[len++] = c;
+        }
+    }
+}
+
+/**********************************************************************
+* Function: cmd_match
+* Parameters: line - command line
+*             name - command word
+*             p_arg - set to the rest of the line on a match
+* Returns: true when the line is the command word, alone or followed by a space
+**********************************************************************/
+static bool cmd_match(char *line, const char *name, char **p_arg) {
+    size_t len = strlen(name);
+
+    if ((strncmp(line, name, len) != 0) || ((line[len] != 0) && (line[len] != ' '))) {
+        return false;
+    }
+    *p_arg = line + len;
+    return true;
+}
+
+/**********************************************************************
+* Function: process_console_cmd
+* Parameters: line - zero terminated command line
+* Returns: --
+*
+* Description: serial commands
+* -- log               dump the whole wattering history
+* -- log <first> [n]   dump n records starting at index first (0 = oldest)
+* -- moist             soil moisture readings
+* -- pump              pump shunt readings and latched faults
+* -- bus               pump slot lease state
+* -- mem               stack/heap high-water marks
+* -- lat [reset]       main loop period/heartbeat percentiles and overruns
+* -- temp              24h temperature window, heat since the last cycle
+* -- cfg ...           runtime config, see process_cfg_cmd()
+* -- sched ...         weekly schedule, see process_sched_cmd()
+**********************************************************************/
+void process_console_cmd(char *line) {
+    char *arg;
+
+    if (cmd_match(line, "log", &arg)) {
+        uint32_t first = 0;
+        uint32_t n = UINT32_MAX;
+
+        if (*arg) {
+            first = strtoul(arg, &arg, 10);
+            if (*arg) {
+                n = strtoul(arg, &arg, 10);
+            }
+            if (*arg) {
+                printf("log [<first> [n]]\r\n");
+                return;
+            }
+        }
+        print_history(first, n);
+        return;
+    }
+
+    if (strcmp(line, "moist") == 0) {
+        for (int zone = 0; zone < ZoneCount; zone++) {
+            printf("zone %d: %u (wet < %u)%s\r\n", zone, adc_scan_get(moist_slot[zone]), cfg.moist_wet_level[zone],
+                    zone_is_wet(zone) ? " wet" : "");
+        }
+        return;
+    }
+
+    if (strcmp(line, "pump") == 0) {
+        for (int zone = 0; zone < ZoneCount; zone++) {
+            printf("pump %d: %u (open < %u, dry < %u, stall > %u) fault %d\r\n", zone, pump_guard_level(zone),
+                    cfg.pump_limits[zone].open_below, cfg.pump_limits[zone].dry_below, cfg.pump_limits[zone].stall_above,
+                    pump_guard_fault(zone));
+        }
+        return;
+    }
+
+    if (strcmp(line, "bus") == 0) {
+        if (PUMP_BUS_NODE_ID == 0) {
+            printf("bus: standalone\r\n");
+        } else {
+            printf("bus: node %d, state %d, slot holder %d\r\n", bus.node_id(), bus.state(), bus.holder(HAL_GetTick()));
+        }
+        return;
+    }
+
+    if (strcmp(line, "mem") == 0) {
+        mem_stats_report();
+        return;
+    }
+
+    if (strcmp(line, "temp") == 0) {
+        if (temp_stats.valid()) {
+            printf("temp: min " TEMP_Q_FMT ", max " TEMP_Q_FMT ", mean " TEMP_Q_FMT " over %u x %us\r\n",
+                    TEMP_Q_ARGS(temp_stats.min()), TEMP_Q_ARGS(temp_stats.max()), TEMP_Q_ARGS(temp_stats.mean()),
+                    temp_stats.count(), TEMP_STATS_PERIOD_S);
+        } else {
+            printf("temp: no data yet\r\n");
+        }
+        //1/4 degC * s -> 1/10 degC * h
+        uint32_t dh_10 = temp_stats.degree_q_s() / 1440;
+        printf("heat: %lu.%lu degC*h in %lus%s, %lu%% of reference\r\n", (unsigned long)(dh_10 / 10),
+                (unsigned long)(dh_10 % 10), (unsigned long)temp_stats.degree_period_s(),
+                temp_stats.cycle_seen() ? "" : " since boot", (unsigned long)temp_heat_pct());
+        for (int zone = 0; zone < ZoneCount; zone++) {
+            printf("zone %d: runtime %us (base %us)\r\n", zone, zone_runtime[zone], cfg.runtime_s[zone]);
+        }
+        return;
+    }
+
+    if (cmd_match(line, "cfg", &arg)) {
+        process_cfg_cmd(arg);
+        return;
+    }
+
+    if (cmd_match(line, "sched", &arg)) {
+        process_sched_cmd(arg);
+        return;
+    }
+
+    if (cmd_match(line, "lat", &arg)) {
+        if (strcmp(arg, " reset") == 0) {
+            //the histograms are written by control without a lock
+            if (!forward_to_control("lat", "reset")) {
+                loop_stats_reset();
+            }
+        } else {
+            loop_stats_report();
+        }
+        return;
+    }
+
+    printf("unknown cmd: %s\r\n", line);
+}
+
+void print_history(uint32_t first, uint32_t n) {
+    history_record_t rec;
+    uint32_t total = history.count();
+
+    printf("HLog: %lu records, %lu dropped\r\n", (unsigned long)total, (unsigned long)history.dropped());
+    if (first >= total) {
+        return;
+    }
+    if (n > total - first) {
+        n = total - first;
+    }
+    for (uint32_t i = first; i < first + n; i++) {
+        if (history.read(i, &rec) != 0) {
+            printf("%5lu: corrupted\r\n", (unsigned long)i);
+            continue;
+        }
+        printf("%5lu: t=%lu ev=%u zone=%u dur=%us temp=" TEMP_Q_FMT "\r\n", (unsigned long)i,
+                (unsigned long)rec.epoch, rec.event, rec.zone, rec.duration_s, TEMP_Q_ARGS(rec.temp_q));
+    }
+}
+
+/**********************************************************************
+* Function: zone_is_wet
+* Parameters: zone - e_ZONE
+* Returns: true when the probe of the zone reads wet soil
+*
+* Description: missing/shorted probe or no reading yet counts as dry,
+* so the zone falls back to plain scheduled wattering
+**********************************************************************/
+bool zone_is_wet(int zone) {
+    uint16_t level = adc_scan_get(moist_slot[zone]);
+
+    if ((level == ADC_SCAN_INVALID) || (level < MOIST_PROBE_MIN) || (level > MOIST_PROBE_MAX)) {
+        return false;
+    }
+    return (level < cfg.moist_wet_level[zone]);
+}
+
+/**********************************************************************
+* Function: skip_zone
+* Parameters: zone - zone of the next pump step
+*             temp_q, time_now - for the history record
+* Returns: true when the pump step is to be skipped
+*
+* Description: called right before each pump step of the sequence,
+* zones outside the event mask and wet zones are skipped
+**********************************************************************/
+bool skip_zone(e_ZONE zone, temp_q_t temp_q, time_t time_now) {
+    if ((cycle_zone_mask & (1 << zone)) == 0) {
+        printf("SMinf: zone %d not scheduled, skipped\r\n", zone);
+        return true;
+    }
+    if (!zone_is_wet(zone)) {
+        return false;
+    }
+    history.append(HistZoneSkipped, zone, 0, temp_q, time_now);
+    printf("SMinf: zone %d wet (%u), skipped\r\n", zone, adc_scan_get(moist_slot[zone]));
+    return true;
+}
+
+#if MBED_CONF_RTOS_PRESENT
+/**********************************************************************
+* Function: control_task
+* Parameters: --
+* Returns: --
+*
+* Description: pump sequence, fan and slot leasing, highest priority.
+* Never blocks on the other threads: a full display mailbox drops the
+* frame, menu actions are picked up once per iteration.
+**********************************************************************/
+void control_task(void) {
+    ds3231_time_t now_time;
+    uint32_t heartbeatTime = 0;
+
+    loop_stats_boot_ready();
+
+    while (true) {
+        uint32_t timenow = HAL_GetTick();
+        loop_stats_iteration();
+
+        ui_cmd_t *p_cmd;
+        while ((p_cmd = ui_cmd_mail.try_get()) != NULL) {
+            if (p_cmd->action == e_UI_ACTION::UiConsoleCmd) {
+                process_console_cmd(p_cmd->line);
+            } else {
+                control_ui_action(p_cmd->action);
+            }
+            ui_cmd_mail.free(p_cmd);
+        }
+
+        control_service();
+
+        if ((timenow - heartbeatTime) > HBLED_TIME_MS) {
+            heartbeatTime = timenow;
+
+            control_heartbeat(&now_time);
+
+            display_msg_t *p_msg = display_mail.try_alloc();
+            if (p_msg != NULL) {
+                p_msg->now = now_time;
+                p_msg->next = next_event;
+                p_msg->next_valid = next_valid;
+                display_mail.put(p_msg);
+            }
+        }
+
+        thread_sleep_for(MAIN_LOOP_DELAY_MS);
+    }
+}
+
+/**********************************************************************
+* Function: display_task
+* Parameters: --
+* Returns: --
+*
+* Description: buttons and LCD, redraws on every heartbeat frame from
+* control_task and on button presses
+**********************************************************************/
+void display_task(void) {
+    display_msg_t frame = {};
+
+    bool input_select = 0, input_enter = 0;
+    bool previous_select = 0, previous_enter = 0;
+
+    while (true) {
+        display_msg_t *p_msg;
+        while ((p_msg = display_mail.try_get()) != NULL) {
+            frame = *p_msg;
+            display_mail.free(p_msg);
+            display_input(e_BTN_EVENT::BtnNone, &frame.now, frame.next_valid ? &frame.next : NULL);
+        }
+
+        btn_debounce(btn_select.read(), btn_enter.read(), &input_select, &input_enter);
+
+        if (previous_enter != input_enter) {
+            previous_enter = input_enter;
+            printf("ENTER: %d\n", input_enter);
+            if (input_enter == 1) {
+                display_input(e_BTN_EVENT::BtnPressedEnter, &frame.now, frame.next_valid ? &frame.next : NULL);
+            }
+        }
+        if (previous_select != input_select) {
+            previous_select = input_select;
+            printf("SELECT: %d\n", input_select);
+            if (input_select == 1) {
+                display_input(e_BTN_EVENT::BtnPressedSelect, &frame.now, frame.next_valid ? &frame.next : NULL);
+            }
+        }
+
+        thread_sleep_for(BTN_POLL_MS);
+    }
+}
+
+/**********************************************************************
+* Function: display_input
+* Parameters: btn_input - button event
+*             p_now, p_next - last heartbeat frame, p_next NULL = no schedule
+* Returns: --
+*
+* Description: runs the menu, an action goes to control_task through
+* ui_cmd_mail
+**********************************************************************/
+void display_input(e_BTN_EVENT btn_input, ds3231_time_t *p_now, const sched_event_t *p_next) {
+    e_UI_ACTION action = update_screen(btn_input, p_now, p_next);
+
+    if (action != e_UI_ACTION::UiNone) {
+        ui_cmd_t *p_cmd = ui_cmd_mail.try_alloc();
+        if (p_cmd == NULL) {
+            printf("UI: control busy, action dropped\r\n");
+            return;
+        }
+        p_cmd->action = action;
+        ui_cmd_mail.put(p_cmd);
+    }
+}
+
+/**********************************************************************
+* Function: forward_to_control
+* Parameters: cmd, arg - console command and its arguments
+* Returns: true when the command went to control_task, false when the
+* caller runs it in place
+*
+* Description: the RTOS console thread must not change the schedule or
+* memset the config under control's feet, the command is mailed to
+* control_task which runs it between two iterations. Bare metal and
+* within control the caller already is the control context.
+**********************************************************************/
+bool forward_to_control(const char *cmd, const char *arg) {
+#if MBED_CONF_RTOS_PRESENT
+    if (ThisThread::get_id() == control_thread.get_id()) {
+        return false;
+    }
+
+    ui_cmd_t *p_cmd = ui_cmd_mail.try_alloc();
+    if (p_cmd == NULL) {
+        printf("%s: control busy, try again\r\n", cmd);
+        return true;
+    }
+    p_cmd->action = e_UI_ACTION::UiConsoleCmd;
+    snprintf(p_cmd->line, sizeof(p_cmd->line), "%s %s", cmd, arg);
+    ui_cmd_mail.put(p_cmd);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**********************************************************************
+* Function: comms_task
+* Parameters: --
+* Returns: --
+*
+* Description: serial console, lowest priority
+**********************************************************************/
+void comms_task(void) {
+    while (true) {
+        poll_console();
+        thread_sleep_for(CONSOLE_POLL_MS);
+    }
+}
+#endif
+
+/**********************************************************************
+* Function: temp_heat_pct
+* Parameters: --
+* Returns: heat since the last cycle in % of cfg.temp_dh_ref_ch
+*
+* Description: 100 when there is not enough data yet
+**********************************************************************/
+uint32_t temp_heat_pct(void) {
+    uint64_t heat = temp_stats.degree_q_s();
+    uint32_t period = temp_stats.degree_period_s();
+
+    if (!temp_stats.cycle_seen()) {
+        if (period < TEMP_DH_MIN_S) {
+            return 100;
+        }
+        heat = (heat * TEMP_CYCLE_NOMINAL_S) / period;
+    }
+    return (heat * 100) / ((uint32_t)cfg.temp_dh_ref_ch * TEMP_DH_CH_TO_Q_S);
+}
+
+/**********************************************************************
+* Function: update_zone_runtimes
+* Parameters: --
+* Returns: --
+*
+* Description: scales the base runtime of every zone by the heat since
+* the last cycle, weighted by the zone gain, called at cycle start
+**********************************************************************/
+void update_zone_runtimes(void) {
+    int32_t heat_pct = temp_heat_pct();
+
+    for (int zone = 0; zone < ZoneCount; zone++) {
+        int32_t pct = 100 + ((int32_t)cfg.temp_gain[zone] * (heat_pct - 100)) / 100;
+
+        if (pct < TEMP_SCALE_MIN_PCT) {
+            pct = TEMP_SCALE_MIN_PCT;
+        }
+        if (pct > TEMP_SCALE_MAX_PCT) {
+            pct = TEMP_SCALE_MAX_PCT;
+        }
+        zone_runtime[zone] = ((uint32_t)cfg.runtime_s[zone] * pct) / 100;
+        if (zone_runtime[zone] == 0) {
+            zone_runtime[zone] = 1;
+        }
+    }
+    printf("SMinf: heat %ld%%, runtimes 12V %us A %us B %us\r\n", (long)heat_pct, zone_runtime[Zone12V],
+            zone_runtime[ZoneA], zone_runtime[ZoneB]);
+}
+
+/**********************************************************************
+* Function: config_defaults
+* Parameters: p_cfg - filled with the compile time defaults
+* Returns: --
+**********************************************************************/
+void config_defaults(app_config_t *p_cfg) {
+    memset(p_cfg, 0, sizeof(*p_cfg));
+    p_cfg->runtime_s[Zone12V] = C_RUNTIME_12VPUMP;
+    p_cfg->runtime_s[ZoneA] = A_RUNTIME_STROMEK;
+    p_cfg->runtime_s[ZoneB] = B_RUNTIME_KVETINAC;
+    p_cfg->pause_s = PAUSE_TIME;
+    p_cfg->moist_wet_level[Zone12V] = MOIST_WET_LEVEL_12V;
+    p_cfg->moist_wet_level[ZoneA] = MOIST_WET_LEVEL_A;
+    p_cfg->moist_wet_level[ZoneB] = MOIST_WET_LEVEL_B;
+    p_cfg->fan_on_q = FAN_ON_TEMP_Q;
+    p_cfg->fan_off_q = FAN_OFF_TEMP_Q;
+    p_cfg->temp_gain[Zone12V] = TEMP_GAIN_12V;
+    p_cfg->temp_gain[ZoneA] = TEMP_GAIN_A;
+    p_cfg->temp_gain[ZoneB] = TEMP_GAIN_B;
+    p_cfg->temp_dh_ref_ch = TEMP_DH_REF_CH;
+    if (Board::PUMP_SHUNTS) {
+        memcpy(p_cfg->pump_limits, pump_limits_default, sizeof(p_cfg->pump_limits));
+    }
+
+    Schedule defaults;
+    defaults.add(SCHED_EVERY_DAY, SCHED_DEFAULT_AM_H, 0, SCHED_ZONES_ALL);
+    defaults.add(SCHED_EVERY_DAY, SCHED_DEFAULT_PM_H, 0, SCHED_ZONES_ALL);
+    defaults.store(p_cfg->sched, &p_cfg->sched_count);
 }
 
-void set_next_time(ds3231_time_t *p_target) {
-    if (p_target->hours > 20){
-        //after 9pm, next cycle is at 8:30am
-        p_target->hours=8;
-        p_target->minutes=00;
-        p_target->seconds=00;
+/**********************************************************************
+* Function: config_load
+* Parameters: --
+* Returns: --
+*
+* Description: boot time, stored config or the defaults into cfg
+**********************************************************************/
+void config_load(void) {
+    uint32_t start_us = us_ticker_read();
+    int result = -4;
+
+    config_defaults(&cfg);
+    if (cfg_store.init() == 0) {
+        result = cfg_store.load(&cfg);
+    }
+
+    if (result == 0) {
+        printf("cfg: #%lu loaded in %lu us\r\n", (unsigned long)cfg.seq, (unsigned long)(us_ticker_read() - start_us));
+    } else if (result == -3) {
+        printf("cfg: stored config is another version, defaults\r\n");
+    } else {
+        printf("cfg: no valid config (%d), defaults\r\n", result);
+    }
+
+    for (int zone = 0; zone < ZoneCount; zone++) {
+        zone_runtime[zone] = cfg.runtime_s[zone];
+    }
+
+    if (schedule.load(cfg.sched, cfg.sched_count) != 0) {
+        app_config_t defaults;
+
+        printf("cfg: schedule invalid, defaults\r\n");
+        config_defaults(&defaults);
+        schedule.load(defaults.sched, defaults.sched_count);
+    }
+    sched_changed = true;
+}
+
+static void *cfg_item_value(const cfg_item_t *p_item, int index) {
+    return (uint8_t *)p_item->p_value + (index * p_item->stride);
+}
+
+static void print_cfg_item(const cfg_item_t *p_item) {
+    printf("%s:", p_item->name);
+    for (int i = 0; i < p_item->count; i++) {
+        if (p_item->temp) {
+            temp_q_t temp_q = *(temp_q_t *)cfg_item_value(p_item, i);
+            printf(" " TEMP_Q_FMT, TEMP_Q_ARGS(temp_q));
+        } else {
+            printf(" %u", *(uint16_t *)cfg_item_value(p_item, i));
+        }
+    }
+    printf("\r\n");
+}
+
+/**********************************************************************
+* Function: process_cfg_cmd
+* Parameters: arg - command line after "cfg"
+* Returns: --
+*
+* Description: runtime config, changes apply from the next cycle, all
+* but the listing run in the control context (see forward_to_control())
+* -- cfg                       show all values
+* -- cfg <item> <value>        set a single value (pause, fanon, fanoff, heat)
+* -- cfg <item> <zone> <value> set a per zone value (run, wet, gain,
+*                              open, dry, stall = pump guard bands, 0 = check off)
+* -- cfg save                  keep the config and the schedule in flash (not while wattering)
+* -- cfg defaults              back to the compile time defaults and schedule (not saved)
+**********************************************************************/
+void process_cfg_cmd(char *arg) {
+    while (*arg == ' ') {
+        arg++;
+    }
+
+    if (*arg == 0) {
+        for (unsigned int i = 0; i < CFG_ITEM_COUNT; i++) {
+            print_cfg_item(&cfg_items[i]);
+        }
+        return;
+    }
+    //the wattering check and the save must not race a cycle start, nor a
+    //"cfg defaults" rewriting cfg
+    if (forward_to_control("cfg", arg)) {
+        return;
+    }
+
+    if (strcmp(arg, "save") == 0) {
+        //a full sector gets erased first, which stalls the pump guard interrupt
+        if (flag_wattering_in_progress) {
+            printf("cfg: busy wattering, try later\r\n");
+            return;
+        }
+        schedule.store(cfg.sched, &cfg.sched_count);
+        int result = cfg_store.save(&cfg);
+        printf("cfg: save %s (%d)\r\n", (result == 0) ? "ok" : "failed", result);
+        return;
+    }
+
+    if (strcmp(arg, "defaults") == 0) {
+        config_defaults(&cfg);
+        schedule.load(cfg.sched, cfg.sched_count);
+        sched_changed = true;
+        printf("cfg: defaults, \"cfg save\" to keep them\r\n");
+        return;
+    }
+
+    for (unsigned int i = 0; i < CFG_ITEM_COUNT; i++) {
+        const cfg_item_t *p_item = &cfg_items[i];
+        size_t len = strlen(p_item->name);
+
+        if ((strncmp(arg, p_item->name, len) != 0) || (arg[len] != ' ')) {
+            continue;
+        }
+
+        char *p_end;
+        long index = 0;
+        long value = strtol(arg + len, &p_end, 10);
+        if (p_item->count > 1) {
+            index = value;
+            value = strtol(p_end, &p_end, 10);
+        }
+        if ((*p_end != 0) || (index < 0) || (index >= p_item->count) || (value < p_item->min) || (value > p_item->max)) {
+            printf("cfg: %s%s <%ld..%ld>\r\n", p_item->name, (p_item->count > 1) ? " <zone>" : "",
+                    (long)p_item->min, (long)p_item->max);
+            return;
+        }
+
+        if (p_item->temp) {
+            temp_q_t value_q = TEMP_C_TO_Q(value);
+            //fan on above fanon, off below fanoff, an inverted pair breaks the hysteresis
+            if (((p_item->p_value == &cfg.fan_on_q) && (value_q <= cfg.fan_off_q)) ||
+                ((p_item->p_value == &cfg.fan_off_q) && (value_q >= cfg.fan_on_q))) {
+                printf("cfg: fanon has to stay above fanoff\r\n");
+                return;
+            }
+            *(temp_q_t *)cfg_item_value(p_item, index) = value_q;
+        } else {
+            *(uint16_t *)cfg_item_value(p_item, index) = value;
+        }
+        print_cfg_item(p_item);
         return;
     }
-    else if (p_target->hours > 7){
-        //after 8:30am, next cycle is at 9pm
-        p_target->hours=21;
-        p_target->minutes=00;
-        p_target->seconds=00;
+
+    printf("cfg: unknown %s\r\n", arg);
+}
+
+static void print_sched_time(uint32_t week_min) {
+    printf("%s %02u:%02u", day_name[week_min / SCHED_DAY_MIN], (unsigned int)((week_min % SCHED_DAY_MIN) / 60),
+            (unsigned int)(week_min % 60));
+}
+
+/**********************************************************************
+* Function: process_sched_cmd
+* Parameters: arg - command line after "sched"
+* Returns: --
+*
+* Description: weekly schedule, applies at once, "cfg save" keeps it
+* -- sched                              list the slots and the next event
+* -- sched add <day> <hh> <mm> [zones]  day 0 = Sunday .. 6, 7 = every day,
+*                                       zones bit mask per e_ZONE, default all
+* -- sched del <index>                  remove a slot
+* -- sched clear                        remove all slots
+**********************************************************************/
+void process_sched_cmd(char *arg) {
+    char *p_end;
+
+    while (*arg == ' ') {
+        arg++;
+    }
+    //edits go between two control iterations, not between the sched_changed check and advance()
+    if ((*arg != 0) && forward_to_control("sched", arg)) {
         return;
     }
-    else {
-        printf("ERROR: next time not set!\r\n");
-    }
-    // else if (p_target->hours > 7){
-    //     //after Xam, next cycle is at 2:05pm
-    //     p_target->hours=14;
-    //     p_target->minutes=05;
-    //     p_target->seconds=00;
-    //     return;
-    // }
-    return;
-}
\ No newline at end of file
+
+    if (strncmp(arg, "add ", 4) == 0) {
+        long day = strtol(arg + 4, &p_end, 10);
+        long hours = strtol(p_end, &p_end, 10);
+        long minutes = strtol(p_end, &p_end, 10);
+        long zones = SCHED_ZONES_ALL;
+        if (*p_end) {
+            zones = strtol(p_end, &p_end, 0);
+        }
+        if ((*p_end != 0) || (day < 0) || (day > SCHED_EVERY_DAY) || (hours < 0) || (hours > 23) ||
+            (minutes < 0) || (minutes > 59) || (zones < 1) || (zones > SCHED_ZONES_ALL)) {
+            printf("sched: add <day 0-6, 7 = every day> <hh> <mm> [zones 1..%d]\r\n", SCHED_ZONES_ALL);
+            return;
+        }
+        int result = schedule.add(day, hours, minutes, zones);
+        if (result != 0) {
+            printf("sched: table full, max %d slots%s\r\n", SCHED_MAX_SLOTS,
+                    (day == SCHED_EVERY_DAY) ? ", only the first days added" : "");
+        }
+        sched_changed = true;
+    } else if (strncmp(arg, "del ", 4) == 0) {
+        long index = strtol(arg + 4, &p_end, 10);
+        if ((*p_end != 0) || (index < 0) || (index >= schedule.count()) || (schedule.remove(index) != 0)) {
+            printf("sched: del <index>, see \"sched\"\r\n");
+            return;
+        }
+        sched_changed = true;
+    } else if (strcmp(arg, "clear") == 0) {
+        schedule.clear();
+        sched_changed = true;
+    } else if (*arg != 0) {
+        printf("sched: unknown %s\r\n", arg);
+        return;
+    }
+
+    printf("sched: %u/%u slots\r\n", schedule.count(), SCHED_MAX_SLOTS);
+    for (int i = 0; i < schedule.count(); i++) {
+        sched_slot_t slot = schedule.slot(i);
+        printf("%2d: ", i);
+        print_sched_time(slot.week_min);
+        printf(" zones 0x%x\r\n", slot.zone_mask);
+    }
+
+    sched_event_t next;
+    uint32_t now_epoch = rtc.get_epoch();
+    if (schedule.find_next(now_epoch, &next)) {
+        printf("next: #%u in %lus\r\n", next.index, (unsigned long)(next.epoch - now_epoch));
+    }
+}
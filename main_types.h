@@ -1,6 +1,9 @@
 #ifndef __MAIN_TYPES_H__
 #define __MAIN_TYPES_H__
 
+#include <cstdint>
+#include <cstdlib>
+
 enum e_SUIJIN_STATE {
     WaitingForNextCycle = 0,
     InitSetup,
@@ -10,7 +13,8 @@ enum e_SUIJIN_STATE {
     Pause_A,
     RunningPump_B,
     Pause_B,
-    Appendix
+    Appendix,
+    WaitingForSlot
 };
 
 enum e_BTN_EVENT {
@@ -20,6 +24,13 @@ enum e_BTN_EVENT {
     BtnPressedBoth
 };
 
+enum e_UI_ACTION {
+    UiNone = 0,
+    UiSkipNext,
+    UiManualRun,
+    UiConsoleCmd        // RTOS: console line run in the control context
+};
+
 enum e_EVENT {
     EventNone = 0,
     EventTriggerWattering,
@@ -27,6 +38,14 @@ enum e_EVENT {
     EventStopCmd
 };
 
+enum e_ZONE {
+    Zone12V = 0,
+    ZoneA,
+    ZoneB,
+    ZoneCount,
+    ZoneNone = 0xFF
+};
+
 enum e_MENU_SCREEN {
     ScrHome = 0,
     ScrManualTrigger
@@ -35,4 +54,13 @@ enum e_MENU_SCREEN {
 #define MOTOR_ENABLE 1
 #define MOTOR_DISABLE 0
 
+// temperature in fixed point 1/4 degC, native resolution of the DS3231
+typedef int16_t temp_q_t;
+
+#define TEMP_C_TO_Q(c)  ((temp_q_t)((c) * 4))
+
+// printf helpers, usage: printf("temp " TEMP_Q_FMT "\n", TEMP_Q_ARGS(t));
+#define TEMP_Q_FMT      "%s%d.%02d"
+#define TEMP_Q_ARGS(q)  (((q) < 0) ? "-" : ""), (abs(q) >> 2), ((abs(q) & 0x03) * 25)
+
 #endif
\ No newline at end of file
@@ -0,0 +1,218 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: mem_stats.cpp
+ *
+ * __Description:__
+ * stack painting + heap statistics, see mem_stats.h
+ * bare metal: main code and interrupts share the MSP stack, its bounds come
+ * from the mbed boot code (mbed_stack_isr_start/size)
+ * RTOS: thread stacks are watermarked by RTX, only reported here
+ *******************************************************************************/
+
+#include "mem_stats.h"
+
+#if MEM_STATS_ENABLED
+
+#include "platform/mbed_stats.h"
+#if MBED_MEM_TRACING_ENABLED
+#include "platform/mbed_mem_trace.h"
+#endif
+
+// threads listed by the RTOS report
+#define MEM_MAX_THREADS 8
+
+static void heap_report(void) {
+    mbed_stats_heap_t heap;
+
+    mbed_stats_heap_get(&heap);
+    printf("heap: %lu B reserved, current %lu B, max %lu B, %lu allocs, %lu failed, overhead %lu B\r\n",
+            (unsigned long)heap.reserved_size, (unsigned long)heap.current_size, (unsigned long)heap.max_size,
+            (unsigned long)heap.alloc_cnt, (unsigned long)heap.alloc_fail_cnt, (unsigned long)heap.overhead_size);
+}
+
+#if MBED_CONF_RTOS_PRESENT
+
+void mem_stats_init(void) {
+}
+
+void mem_stats_report(void) {
+    mbed_stats_stack_t stacks[MEM_MAX_THREADS];
+    int count = mbed_stats_stack_get_each(stacks, MEM_MAX_THREADS);
+
+    if (count == 0) {
+        printf("stack: no data, enable platform.stack-stats-enabled\r\n");
+    }
+    for (int i = 0; i < count; i++) {
+        const char *name = osThreadGetName((osThreadId_t)stacks[i].thread_id);
+        printf("stack %s: %lu B, peak %lu B\r\n", name ? name : "?", (unsigned long)stacks[i].reserved_size,
+                (unsigned long)stacks[i].max_size);
+    }
+    heap_report();
+}
+
+#else
+
+#define MEM_PAINT       0xA5A5A5A5u
+// room left for the frame of the painting function itself
+#define MEM_SP_MARGIN   64
+
+extern "C" {
+    extern unsigned char *mbed_stack_isr_start;
+    extern uint32_t mbed_stack_isr_size;
+}
+
+static const char *const site_name[MemSiteCount] = {
+    "update_screen",
+    "process_state",
+    "console",
+    "get_user_input"
+};
+
+static uint32_t site_stack_peak[MemSiteCount];
+static int32_t site_heap_peak[MemSiteCount];
+static uint32_t site_calls[MemSiteCount];
+
+static int site_active = -1;
+static uint32_t *site_window_bottom;
+static uintptr_t site_sp;
+static uint32_t site_heap_start;
+static uint32_t site_heap_top;      // tracing: highest current_size inside the site, else all-time max at its start
+
+static uint32_t stack_peak = 0;
+
+static uint32_t *stack_bottom(void) {
+    return (uint32_t *)mbed_stack_isr_start;
+}
+
+static uintptr_t stack_top(void) {
+    return (uintptr_t)mbed_stack_isr_start + mbed_stack_isr_size;
+}
+
+#if MBED_MEM_TRACING_ENABLED
+static uint32_t heap_current(void) {
+    mbed_stats_heap_t heap;
+    mbed_stats_heap_get(&heap);
+    return heap.current_size;
+}
+
+// every allocation, the stats are already updated when it is called
+static void heap_trace(uint8_t op, void *res, void *caller, ...) {
+    if ((site_active >= 0) && (op != MBED_MEM_TRACE_FREE)) {
+        uint32_t current = heap_current();
+        if (current > site_heap_top) {
+            site_heap_top = current;
+        }
+    }
+}
+#endif
+
+// heap peak reached since mem_site_begin()
+static uint32_t site_heap_end(void) {
+    mbed_stats_heap_t heap;
+    mbed_stats_heap_get(&heap);
+
+#if MBED_MEM_TRACING_ENABLED
+    return (heap.current_size > site_heap_top) ? heap.current_size : site_heap_top;
+#else
+    // a peak below the all-time max of the site start leaves no trace
+    return (heap.max_size > site_heap_top) ? heap.max_size : heap.current_size;
+#endif
+}
+
+// lowest overwritten word at or above p_from
+static uint32_t *first_dirty(uint32_t *p_from, uint32_t *p_limit) {
+    while ((p_from < p_limit) && (*p_from == MEM_PAINT)) {
+        p_from++;
+    }
+    return p_from;
+}
+
+static void paint(uint32_t *p_from, uint32_t *p_to) {
+    while (p_from < p_to) {
+        *p_from++ = MEM_PAINT;
+    }
+}
+
+/**********************************************************************
+* Function: stack_peak_update
+* Parameters: --
+* Returns: --
+*
+* Description: all-time peak = top of stack - lowest overwritten word,
+* must run before any repaint hides the evidence
+**********************************************************************/
+static void stack_peak_update(void) {
+    uintptr_t sp = __get_MSP() - MEM_SP_MARGIN;
+    uint32_t *p_dirty = first_dirty(stack_bottom(), (uint32_t *)sp);
+    uint32_t used = stack_top() - (uintptr_t)p_dirty;
+
+    if (used > stack_peak) {
+        stack_peak = used;
+    }
+}
+
+void mem_stats_init(void) {
+    paint(stack_bottom(), (uint32_t *)((uintptr_t)__get_MSP() - MEM_SP_MARGIN));
+#if MBED_MEM_TRACING_ENABLED
+    mbed_mem_trace_set_callback(heap_trace);
+#endif
+}
+
+void mem_site_begin(int site) {
+    if (site_active >= 0) {
+        return;
+    }
+    stack_peak_update();
+
+    site_active = site;
+    site_sp = __get_MSP();
+    site_window_bottom = (uint32_t *)((site_sp - MEM_SP_MARGIN - MEM_SITE_WINDOW) & ~(uintptr_t)0x03);
+    if (site_window_bottom < stack_bottom()) {
+        site_window_bottom = stack_bottom();
+    }
+    paint(site_window_bottom, (uint32_t *)(site_sp - MEM_SP_MARGIN));
+
+    mbed_stats_heap_t heap;
+    mbed_stats_heap_get(&heap);
+    site_heap_start = heap.current_size;
+#if MBED_MEM_TRACING_ENABLED
+    site_heap_top = heap.current_size;
+#else
+    site_heap_top = heap.max_size;
+#endif
+}
+
+void mem_site_end(int site) {
+    if (site_active != site) {
+        return;
+    }
+    uint32_t *p_dirty = first_dirty(site_window_bottom, (uint32_t *)(site_sp - MEM_SP_MARGIN));
+    uint32_t depth = site_sp - (uintptr_t)p_dirty;
+    int32_t heap_peak = (int32_t)(site_heap_end() - site_heap_start);
+
+    if (depth > site_stack_peak[site]) {
+        site_stack_peak[site] = depth;
+    }
+    if (heap_peak > site_heap_peak[site]) {
+        site_heap_peak[site] = heap_peak;
+    }
+    site_calls[site]++;
+    site_active = -1;
+}
+
+void mem_stats_report(void) {
+    stack_peak_update();
+    printf("stack: %lu B, peak %lu B\r\n", (unsigned long)mbed_stack_isr_size, (unsigned long)stack_peak);
+    for (int site = 0; site < MemSiteCount; site++) {
+        // a window painted to the bottom means the site may have gone deeper
+        printf("  %-15s %5lu B%s heap peak +%ld B, %lu calls\r\n", site_name[site], (unsigned long)site_stack_peak[site],
+                (site_stack_peak[site] + MEM_SP_MARGIN >= MEM_SITE_WINDOW) ? "+" : " ",
+                (long)site_heap_peak[site], (unsigned long)site_calls[site]);
+    }
+    heap_report();
+}
+
+#endif // MBED_CONF_RTOS_PRESENT
+
+#endif
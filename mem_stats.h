@@ -0,0 +1,70 @@
+#ifndef __MEM_STATS_H__
+#define __MEM_STATS_H__
+
+#include "mbed.h"
+#include <cstdint>
+
+/*
+ * Stack and heap high-water marks.
+ * - the free part of the main stack is painted with a pattern at boot,
+ *   the lowest overwritten word gives the all-time stack peak
+ * - MEM_SITE_BEGIN/END around a call site repaint a window below the current
+ *   stack pointer and measure how deep the call went -> peak per site
+ * - heap numbers come from mbed_stats_heap_get (platform.heap-stats-enabled),
+ *   the heap peak of a site is sampled after every allocation inside it by
+ *   the memory trace callback (platform.memory-tracing-enabled); without it
+ *   only a site that raises the all-time heap max shows its real peak, the
+ *   others show their net growth
+ * Sites do not nest, a site opened inside another one is not measured.
+ * RTOS build: every thread has its own stack, the report lists the peak of
+ * each thread from RTX stack watermarking (platform.stack-stats-enabled)
+ * and the sites compile out.
+ * Build with MEM_STATS_ENABLED=0 to compile it all out.
+ */
+
+#ifndef MEM_STATS_ENABLED
+#define MEM_STATS_ENABLED 1
+#endif
+
+// stack painted below the stack pointer when a site opens
+#define MEM_SITE_WINDOW     2048
+
+enum e_MEM_SITE {
+    MemSiteUpdateScreen = 0,
+    MemSiteProcessState,
+    MemSiteConsole,
+    MemSiteUserInput,
+    MemSiteCount
+};
+
+#if MEM_STATS_ENABLED
+
+/** Paint the free stack, call first thing in main() */
+void mem_stats_init(void);
+
+/** Print stack/heap report to stdout */
+void mem_stats_report(void);
+
+#else
+
+inline void mem_stats_init(void) {}
+inline void mem_stats_report(void) {}
+
+#endif
+
+#if MEM_STATS_ENABLED && !MBED_CONF_RTOS_PRESENT
+
+void mem_site_begin(int site);
+void mem_site_end(int site);
+
+#define MEM_SITE_BEGIN(site)    mem_site_begin(site)
+#define MEM_SITE_END(site)      mem_site_end(site)
+
+#else
+
+#define MEM_SITE_BEGIN(site)
+#define MEM_SITE_END(site)
+
+#endif
+
+#endif
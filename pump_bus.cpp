@@ -0,0 +1,278 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: pump_bus.cpp
+ *
+ * __Description:__
+ * pump slot leasing over a shared serial line, see pump_bus.h
+ * plain C++ without mbed, all time stamps are ms from the caller
+ *******************************************************************************/
+
+#include "pump_bus.h"
+
+#define FRAME_HDR_LEN   5   // SOF src dst type len
+#define HOLD_CLAIMING   0
+#define HOLD_HOLDING    1
+#define HOLD_CONFIRMED  2   // holding and granted(), the pumps may be running
+
+static_assert(PUMP_BUS_HOLD_PERIOD_MS > (PUMP_BUS_MAX_NODES * PUMP_BUS_HOLD_STAGGER_MS),
+              "hold stagger leaves no repeat period for the highest node id");
+
+PumpBus::PumpBus(PumpBusPort *port, uint8_t node_id) :
+    _port(port), _id(node_id), _state(BusIdle),
+    _wait_start_ms(0), _state_ms(0), _last_tx_ms(0), _confirmed(false),
+    _holder(0), _holder_seen_ms(0), _released_ms(0), _gap(false),
+    _rx_len(0)
+{
+    for (int node = 0; node < PUMP_BUS_MAX_NODES; node++) {
+        _req_valid[node] = false;
+        _req_seen_ms[node] = 0;
+        _req_wait_ms[node] = 0;
+    }
+}
+
+void PumpBus::request(uint32_t now_ms) {
+    if (_state != BusIdle) {
+        return;
+    }
+    _state = BusWaiting;
+    _state_ms = now_ms;
+    _wait_start_ms = now_ms;
+    send_req(now_ms);
+}
+
+void PumpBus::release(uint32_t now_ms) {
+    if ((_state == BusHolding) || (_state == BusClaiming)) {
+        send(BusMsgRel, NULL, 0, now_ms);
+        _released_ms = now_ms;
+        _gap = true;
+    }
+    _state = BusIdle;
+    _state_ms = now_ms;
+}
+
+uint8_t PumpBus::holder(uint32_t now_ms) const {
+    if ((_state == BusHolding) || (_state == BusClaiming)) {
+        return _id;
+    }
+    if ((_holder != 0) && ((now_ms - _holder_seen_ms) < PUMP_BUS_HOLD_TIMEOUT_MS)) {
+        return _holder;
+    }
+    return 0;
+}
+
+void PumpBus::poll(uint32_t now_ms) {
+    uint8_t buf[16];
+    int n;
+
+    while ((n = _port->read(buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < n; i++) {
+            uint8_t c = buf[i];
+
+            if ((_rx_len == 0) && (c != PUMP_BUS_SOF)) {
+                continue;
+            }
+            _rx[_rx_len++] = c;
+            if ((_rx_len == FRAME_HDR_LEN) && (_rx[4] > PUMP_BUS_MAX_PAYLOAD)) {
+                _rx_len = 0;
+                continue;
+            }
+            if ((_rx_len > FRAME_HDR_LEN) && (_rx_len == FRAME_HDR_LEN + _rx[4] + 1)) {
+                uint8_t src = _rx[1];
+                uint8_t dst = _rx[2];
+                if ((crc8(&_rx[1], _rx_len - 2) == _rx[_rx_len - 1]) && (src != _id) &&
+                    ((dst == _id) || (dst == PUMP_BUS_BROADCAST))) {
+                    handle_frame(src, _rx[3], &_rx[FRAME_HDR_LEN], _rx[4], now_ms);
+                }
+                _rx_len = 0;
+            }
+        }
+    }
+
+    // silent holder = crashed/disconnected node
+    if ((_holder != 0) && ((now_ms - _holder_seen_ms) >= PUMP_BUS_HOLD_TIMEOUT_MS)) {
+        _holder = 0;
+    }
+    for (int node = 0; node < PUMP_BUS_MAX_NODES; node++) {
+        if (_req_valid[node] && ((now_ms - _req_seen_ms[node]) >= PUMP_BUS_REQ_TIMEOUT_MS)) {
+            _req_valid[node] = false;
+        }
+    }
+    if (_gap && ((now_ms - _released_ms) >= PUMP_BUS_GAP_MS)) {
+        _gap = false;
+    }
+
+    switch (_state) {
+        case BusWaiting:
+            if (((now_ms - _state_ms) >= PUMP_BUS_LISTEN_MS) && may_claim(now_ms)) {
+                uint8_t flag = HOLD_CLAIMING;
+                _state = BusClaiming;
+                _state_ms = now_ms;
+                send(BusMsgHold, &flag, 1, now_ms);
+            } else if ((now_ms - _last_tx_ms) >= PUMP_BUS_REQ_PERIOD_MS) {
+                send_req(now_ms);
+            }
+            break;
+
+        case BusClaiming:
+            if ((now_ms - _state_ms) >= PUMP_BUS_CLAIM_MS) {
+                _state = BusHolding;
+                _state_ms = now_ms;
+                _confirmed = false;
+                send_hold(now_ms);
+            }
+            break;
+
+        case BusHolding:
+            if ((now_ms - _state_ms) >= PUMP_BUS_CONFIRM_MS) {
+                _confirmed = true;
+            }
+            if ((now_ms - _last_tx_ms) >= (uint32_t)(PUMP_BUS_HOLD_PERIOD_MS - (_id * PUMP_BUS_HOLD_STAGGER_MS))) {
+                send_hold(now_ms);
+            }
+            break;
+
+        case BusIdle:
+        default:
+            break;
+    }
+}
+
+void PumpBus::handle_frame(uint8_t src, uint8_t type, const uint8_t *payload, uint8_t len, uint32_t now_ms) {
+    if ((src == 0) || (src >= PUMP_BUS_MAX_NODES)) {
+        return;
+    }
+
+    switch (type) {
+        case BusMsgReq:
+            if (len >= 2) {
+                _req_valid[src] = true;
+                _req_seen_ms[src] = now_ms;
+                _req_wait_ms[src] = ((uint32_t)payload[0] | ((uint32_t)payload[1] << 8)) * 100;
+            }
+            break;
+
+        case BusMsgHold: {
+            bool holding = (len >= 1) && (payload[0] >= HOLD_HOLDING);
+            bool confirmed = (len >= 1) && (payload[0] == HOLD_CONFIRMED);
+
+            _req_valid[src] = false;
+            if (_state == BusHolding) {
+                // two holders: a confirmed one may be pumping already and keeps
+                // the slot, between unconfirmed ones the lower id wins; both
+                // confirmed (frames lost for longer than the confirm period)
+                // falls back to the id, the caller stops on !granted()
+                bool yield = holding && (src < _id);
+                if (_confirmed != confirmed) {
+                    yield = confirmed;
+                }
+                if (!yield) {
+                    // a late claimer has to hear we are already running
+                    send_hold(now_ms);
+                    break;
+                }
+                // back to waiting, keep our waiting time
+                _state = BusWaiting;
+                _state_ms = now_ms;
+                _confirmed = false;
+            }
+            if (_state == BusClaiming) {
+                if (!holding && (src > _id)) {
+                    // simultaneous claim, lower id keeps it
+                    break;
+                }
+                _state = BusWaiting;
+                _state_ms = now_ms;
+            }
+            _holder = src;
+            _holder_seen_ms = now_ms;
+            break;
+        }
+
+        case BusMsgRel:
+            _req_valid[src] = false;
+            if (_holder == src) {
+                _holder = 0;
+                _released_ms = now_ms;
+                _gap = true;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**********************************************************************
+* Function: may_claim
+* Parameters: now_ms
+* Returns: true when this node is next in line for a free slot
+*
+* Description: longest waiting node first, lower node id on a tie,
+* waiting times of the others are extrapolated from their last REQ
+**********************************************************************/
+bool PumpBus::may_claim(uint32_t now_ms) const {
+    if ((holder(now_ms) != 0) || _gap) {
+        return false;
+    }
+
+    uint32_t my_wait = now_ms - _wait_start_ms;
+    for (int node = 1; node < PUMP_BUS_MAX_NODES; node++) {
+        if (!_req_valid[node] || (node == _id)) {
+            continue;
+        }
+        uint32_t their_wait = _req_wait_ms[node] + (now_ms - _req_seen_ms[node]);
+        if ((their_wait > my_wait) || ((their_wait == my_wait) && (node < _id))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PumpBus::send_req(uint32_t now_ms) {
+    uint32_t wait = (now_ms - _wait_start_ms) / 100;
+    uint8_t payload[2];
+
+    if (wait > 0xFFFF) {
+        wait = 0xFFFF;
+    }
+    payload[0] = wait & 0xFF;
+    payload[1] = (wait >> 8) & 0xFF;
+    send(BusMsgReq, payload, sizeof(payload), now_ms);
+}
+
+void PumpBus::send_hold(uint32_t now_ms) {
+    uint8_t flag = _confirmed ? HOLD_CONFIRMED : HOLD_HOLDING;
+
+    send(BusMsgHold, &flag, 1, now_ms);
+}
+
+void PumpBus::send(uint8_t type, const uint8_t *payload, uint8_t len, uint32_t now_ms) {
+    uint8_t frame[FRAME_HDR_LEN + PUMP_BUS_MAX_PAYLOAD + 1];
+
+    frame[0] = PUMP_BUS_SOF;
+    frame[1] = _id;
+    frame[2] = PUMP_BUS_BROADCAST;
+    frame[3] = type;
+    frame[4] = len;
+    for (uint8_t i = 0; i < len; i++) {
+        frame[FRAME_HDR_LEN + i] = payload[i];
+    }
+    frame[FRAME_HDR_LEN + len] = crc8(&frame[1], FRAME_HDR_LEN - 1 + len);
+
+    _port->write(frame, FRAME_HDR_LEN + len + 1);
+    _last_tx_ms = now_ms;
+}
+
+// CRC-8, poly 0x07
+uint8_t PumpBus::crc8(const uint8_t *p, size_t len) {
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+        }
+    }
+    return crc;
+}
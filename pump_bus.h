@@ -0,0 +1,138 @@
+#ifndef __PUMP_BUS_H__
+#define __PUMP_BUS_H__
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Pump slot leasing between controllers sharing one water/power supply.
+ *
+ * All nodes hang on one half-duplex multi-drop line (RS-485 or open-drain
+ * UART). At most one node holds the pump slot at a time:
+ * - a node that wants to water broadcasts REQ with how long it has waited
+ * - when nobody holds the slot, the longest waiting node (lower id on a tie)
+ *   claims it by broadcasting HOLD and listens for PUMP_BUS_CLAIM_MS, a
+ *   colliding claim of a lower id wins, the other node backs off
+ * - claims sent at the same moment garble each other on the line, then two
+ *   nodes end up holding: an unconfirmed holder hearing the HOLD of a lower
+ *   id or of a confirmed holder goes back to waiting. The repeat period is
+ *   staggered by node id so the holds stop colliding, and granted() only
+ *   turns true after PUMP_BUS_CONFIRM_MS of uncontested holding, HOLD then
+ *   says so and the slot is not taken away by id any more. Only when both
+ *   holders confirmed (frames lost for that long) the higher id loses
+ *   granted() and the caller has to stop its pumps
+ * - the holder repeats HOLD about every PUMP_BUS_HOLD_PERIOD_MS and sends REL
+ *   when done, a silent holder loses the slot after PUMP_BUS_HOLD_TIMEOUT_MS
+ * - after a release the slot stays free for PUMP_BUS_GAP_MS, so sequences
+ *   of different nodes are staggered instead of starting back to back
+ *
+ * Frame: 0x7E | src | dst | type | len | payload[len] | crc8 (over src..payload)
+ *
+ * The code has no mbed dependency, the bytes go through PumpBusPort and time
+ * is passed in, so the same protocol runs in the host simulator (tools/bus_sim).
+ */
+
+#define PUMP_BUS_SOF                0x7E
+#define PUMP_BUS_BROADCAST          0xFF
+#define PUMP_BUS_MAX_PAYLOAD        4
+#define PUMP_BUS_MAX_NODES          16
+
+#define PUMP_BUS_REQ_PERIOD_MS      500
+#define PUMP_BUS_REQ_TIMEOUT_MS     1600
+#define PUMP_BUS_LISTEN_MS          1200
+#define PUMP_BUS_CLAIM_MS           300
+#define PUMP_BUS_HOLD_PERIOD_MS     500
+// repeat period of node n = PUMP_BUS_HOLD_PERIOD_MS - n * PUMP_BUS_HOLD_STAGGER_MS
+#define PUMP_BUS_HOLD_STAGGER_MS    20
+#define PUMP_BUS_CONFIRM_MS         1200
+#define PUMP_BUS_HOLD_TIMEOUT_MS    2000
+#define PUMP_BUS_GAP_MS             3000
+
+enum e_BUS_MSG {
+    BusMsgReq = 1,
+    BusMsgHold,
+    BusMsgRel
+};
+
+enum e_BUS_STATE {
+    BusIdle = 0,
+    BusWaiting,
+    BusClaiming,
+    BusHolding
+};
+
+/** Byte transport of the bus, both calls must not block */
+class PumpBusPort {
+public:
+    virtual ~PumpBusPort() {}
+
+    /** @returns number of bytes read, 0 when nothing is pending */
+    virtual int read(uint8_t *buf, size_t len) = 0;
+
+    /** Send a whole frame, the port takes care of the driver enable line */
+    virtual void write(const uint8_t *buf, size_t len) = 0;
+};
+
+/** Port of a standalone controller, nothing goes out, nothing comes in */
+class PumpBusNullPort : public PumpBusPort {
+public:
+    virtual int read(uint8_t *buf, size_t len) { return 0; }
+    virtual void write(const uint8_t *buf, size_t len) {}
+};
+
+class PumpBus {
+public:
+    /** @param node_id  1..PUMP_BUS_MAX_NODES-1, unique on the bus */
+    PumpBus(PumpBusPort *port, uint8_t node_id);
+
+    /** Ask for the pump slot, keeps asking until granted() */
+    void request(uint32_t now_ms);
+
+    /** true once this node holds the slot uncontested for PUMP_BUS_CONFIRM_MS */
+    bool granted() const { return (_state == BusHolding) && _confirmed; }
+
+    /** Give the slot back (or withdraw a pending request) */
+    void release(uint32_t now_ms);
+
+    /** Receive frames and run the timers, call often (every few ms) */
+    void poll(uint32_t now_ms);
+
+    e_BUS_STATE state() const { return _state; }
+
+    /** Node currently holding the slot, 0 = free */
+    uint8_t holder(uint32_t now_ms) const;
+
+    uint8_t node_id() const { return _id; }
+
+private:
+    void handle_frame(uint8_t src, uint8_t type, const uint8_t *payload, uint8_t len, uint32_t now_ms);
+    void send(uint8_t type, const uint8_t *payload, uint8_t len, uint32_t now_ms);
+    void send_req(uint32_t now_ms);
+    void send_hold(uint32_t now_ms);
+    bool may_claim(uint32_t now_ms) const;
+    static uint8_t crc8(const uint8_t *p, size_t len);
+
+    PumpBusPort *_port;
+    uint8_t _id;
+    e_BUS_STATE _state;
+
+    uint32_t _wait_start_ms;
+    uint32_t _state_ms;         // entry of the current state
+    uint32_t _last_tx_ms;
+    bool _confirmed;            // holding survived PUMP_BUS_CONFIRM_MS
+
+    // view of the other nodes
+    uint8_t _holder;
+    uint32_t _holder_seen_ms;
+    uint32_t _released_ms;
+    bool _gap;                  // PUMP_BUS_GAP_MS after a release still running
+    uint32_t _req_seen_ms[PUMP_BUS_MAX_NODES];
+    uint32_t _req_wait_ms[PUMP_BUS_MAX_NODES];  // their waiting time as of _req_seen_ms
+    bool _req_valid[PUMP_BUS_MAX_NODES];
+
+    // receiver
+    uint8_t _rx[5 + PUMP_BUS_MAX_PAYLOAD + 1];
+    uint8_t _rx_len;
+};
+
+#endif
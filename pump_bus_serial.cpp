@@ -0,0 +1,41 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: pump_bus_serial.cpp
+ *
+ * __Description:__
+ * mbed UART transport of the pump bus, see pump_bus_serial.h
+ *******************************************************************************/
+
+#include "pump_bus_serial.h"
+
+SerialBusPort::SerialBusPort(PinName tx, PinName rx, PinName de, int baud) :
+    _serial(tx, rx, baud), _de(de, 0), _has_de(de != NC), _char_us((10 * 1000000) / baud)
+{
+    _serial.set_blocking(false);
+}
+
+int SerialBusPort::read(uint8_t *buf, size_t len) {
+    ssize_t n = _serial.read(buf, len);
+    return (n > 0) ? (int)n : 0;
+}
+
+void SerialBusPort::write(const uint8_t *buf, size_t len) {
+    if (_has_de) {
+        _de = 1;
+    }
+    while (len > 0) {
+        ssize_t n = _serial.write(buf, len);
+        if (n <= 0) {
+            break;
+        }
+        buf += n;
+        len -= n;
+    }
+    if (_has_de) {
+        // tx buffer empty -> last character still in the shift register
+        _serial.sync();
+        wait_us(2 * _char_us);
+        _de = 0;
+    }
+}
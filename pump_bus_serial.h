@@ -0,0 +1,28 @@
+#ifndef __PUMP_BUS_SERIAL_H__
+#define __PUMP_BUS_SERIAL_H__
+
+#include "mbed.h"
+#include "pump_bus.h"
+
+/** PumpBusPort on a hardware UART, optionally driving an RS-485 DE line
+ *
+ * RX is interrupt buffered by BufferedSerial, so the main loop may poll
+ * every few ms without losing bytes. With a DE pin the transmitter is
+ * enabled only for the frame and released once the last bit left the UART.
+ * Pass NC for transceivers with automatic direction control.
+ */
+class SerialBusPort : public PumpBusPort {
+public:
+    SerialBusPort(PinName tx, PinName rx, PinName de, int baud);
+
+    virtual int read(uint8_t *buf, size_t len);
+    virtual void write(const uint8_t *buf, size_t len);
+
+private:
+    BufferedSerial _serial;
+    DigitalOut _de;
+    bool _has_de;
+    int _char_us;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: pump_guard.cpp
+ *
+ * __Description:__
+ * pump current supervision, see pump_guard.h
+ * everything below pump_guard_block() runs in the ADC DMA interrupt
+ *******************************************************************************/
+
+#include "pump_guard.h"
+#include "adc_scan.h"
+
+#define PUMP_GUARD_BLOCK_MS     ((ADC_BLOCK_SCANS * 1000) / ADC_SCAN_RATE_HZ)
+#define PUMP_GUARD_BLANK_BLOCKS ((PUMP_GUARD_BLANK_MS + PUMP_GUARD_BLOCK_MS - 1) / PUMP_GUARD_BLOCK_MS)
+
+static const uint8_t guard_slot[ZoneCount] = { AdcCurrent12V, AdcCurrentA, AdcCurrentB };
+
+static DigitalOut *const *guard_out = NULL;
+static const pump_limits_t *guard_limits = NULL;
+
+static volatile bool guard_armed[ZoneCount];
+static volatile uint8_t guard_fault[ZoneCount];
+static volatile uint16_t guard_level[ZoneCount];
+static uint16_t guard_blank[ZoneCount];
+static uint8_t guard_bad[ZoneCount];
+static volatile bool guard_tripped = false;
+
+static void pump_guard_block(const uint16_t *p_block);
+
+void pump_guard_init(DigitalOut *const outputs[ZoneCount], const pump_limits_t limits[ZoneCount]) {
+    guard_out = outputs;
+    guard_limits = limits;
+
+    for (int zone = 0; zone < ZoneCount; zone++) {
+        guard_armed[zone] = false;
+        guard_fault[zone] = PumpFaultNone;
+        guard_out[zone]->write(MOTOR_DISABLE);
+    }
+    adc_scan_attach(pump_guard_block);
+}
+
+void pump_guard_set(int zone, bool on) {
+    core_util_critical_section_enter();
+    if (!on) {
+        guard_armed[zone] = false;
+        guard_out[zone]->write(MOTOR_DISABLE);
+    } else if ((guard_fault[zone] == PumpFaultNone) && !guard_armed[zone]) {
+        guard_blank[zone] = PUMP_GUARD_BLANK_BLOCKS;
+        guard_bad[zone] = 0;
+        guard_armed[zone] = true;
+        guard_out[zone]->write(MOTOR_ENABLE);
+    }
+    core_util_critical_section_exit();
+}
+
+e_PUMP_FAULT pump_guard_fault(int zone) {
+    return (e_PUMP_FAULT)guard_fault[zone];
+}
+
+bool pump_guard_tripped(void) {
+    return guard_tripped;
+}
+
+void pump_guard_clear(void) {
+    core_util_critical_section_enter();
+    for (int zone = 0; zone < ZoneCount; zone++) {
+        guard_fault[zone] = PumpFaultNone;
+    }
+    guard_tripped = false;
+    core_util_critical_section_exit();
+}
+
+uint16_t pump_guard_level(int zone) {
+    return guard_level[zone];
+}
+
+/**********************************************************************
+* Function: pump_guard_block
+* Parameters: p_block - raw ADC block, see adc_block_handler_t
+* Returns: --
+*
+* Description: classifies the block mean of every armed pump, cuts the
+* output after PUMP_GUARD_TRIP_BLOCKS bad blocks in a row
+**********************************************************************/
+static void pump_guard_block(const uint16_t *p_block) {
+    for (int zone = 0; zone < ZoneCount; zone++) {
+        uint32_t sum = 0;
+        for (int scan = 0; scan < ADC_BLOCK_SCANS; scan++) {
+            sum += p_block[(scan * AdcSlotCount) + guard_slot[zone]];
+        }
+        uint16_t level = sum / ADC_BLOCK_SCANS;
+        guard_level[zone] = level;
+
+        if (!guard_armed[zone]) {
+            continue;
+        }
+        if (guard_blank[zone] > 0) {
+            guard_blank[zone]--;
+            continue;
+        }
+
+        const pump_limits_t *p_lim = &guard_limits[zone];
+        uint8_t fault = PumpFaultNone;
+        if (level < p_lim->open_below) {
+            fault = PumpFaultOpen;
+        } else if (level < p_lim->dry_below) {
+            fault = PumpFaultDryRun;
+        } else if ((p_lim->stall_above != 0) && (level > p_lim->stall_above)) {
+            fault = PumpFaultStall;
+        }
+
+        if (fault == PumpFaultNone) {
+            guard_bad[zone] = 0;
+        } else if (++guard_bad[zone] >= PUMP_GUARD_TRIP_BLOCKS) {
+            guard_out[zone]->write(MOTOR_DISABLE);
+            guard_armed[zone] = false;
+            guard_fault[zone] = fault;
+            guard_tripped = true;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef __PUMP_GUARD_H__
+#define __PUMP_GUARD_H__
+
+#include "mbed.h"
+#include <cstdint>
+
+#include "main_types.h"
+
+/*
+ * Dry-run / stall / open circuit protection of the pump outputs.
+ * Every ADC block (16ms) the mean shunt reading of each running pump is
+ * compared to its limits right in the DMA interrupt. After the inrush blank
+ * time, PUMP_GUARD_TRIP_BLOCKS bad blocks in a row switch the output off
+ * on the spot and latch the fault until pump_guard_clear().
+ * A limit of 0 turns its check off, a zone without a shunt uses {0, 0, 0}.
+ */
+
+// ignore the inrush current after switch on
+#define PUMP_GUARD_BLANK_MS     200
+// consecutive bad blocks before the output is cut, 2 * 16ms
+#define PUMP_GUARD_TRIP_BLOCKS  2
+
+enum e_PUMP_FAULT {
+    PumpFaultNone = 0,
+    PumpFaultOpen,      // no current at all, wire/motor disconnected
+    PumpFaultDryRun,    // pump spins without load, reservoir empty
+    PumpFaultStall      // rotor blocked or clogged
+};
+
+/** Shunt readings (raw 12-bit adc mean) separating the fault bands of one pump, 0 = no check */
+typedef struct {
+    uint16_t open_below;
+    uint16_t dry_below;
+    uint16_t stall_above;
+} pump_limits_t;
+
+/** Hook up the guarded outputs and start listening to the ADC blocks
+ *
+ * @param outputs  pump output per e_ZONE
+ * @param limits   current limits per e_ZONE, read on every block, so changes
+ *                 apply right away
+ */
+void pump_guard_init(DigitalOut *const outputs[ZoneCount], const pump_limits_t limits[ZoneCount]);
+
+/** Switch a pump output, arms/disarms its guard
+ *
+ * Repeated calls with the same state are cheap, the blank time only restarts
+ * on an off->on edge. A faulted output stays off until pump_guard_clear().
+ */
+void pump_guard_set(int zone, bool on);
+
+/** Latched fault of a zone, PumpFaultNone when healthy */
+e_PUMP_FAULT pump_guard_fault(int zone);
+
+/** true when any zone tripped since the last pump_guard_clear() */
+bool pump_guard_tripped(void);
+
+/** Release all latched faults, outputs stay off */
+void pump_guard_clear(void);
+
+/** Last block mean of the shunt of a zone */
+uint16_t pump_guard_level(int zone);
+
+#endif
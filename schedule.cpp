@@ -0,0 +1,181 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: schedule.cpp
+ *
+ * __Description:__
+ * weekly wattering schedule, sorted slot table, see schedule.h
+ *******************************************************************************/
+
+#include "schedule.h"
+#include "platform/ScopedLock.h"
+
+Schedule::Schedule() :
+    _count(0)
+{
+    memset(_slots, 0, sizeof(_slots));
+}
+
+int Schedule::add(uint8_t day, uint8_t hours, uint8_t minutes, uint8_t zone_mask) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if ((day > SCHED_EVERY_DAY) || (hours > 23) || (minutes > 59) ||
+        (zone_mask == 0) || ((zone_mask & ~SCHED_ZONES_ALL) != 0)) {
+        return -1;
+    }
+
+    uint16_t day_min = (hours * 60) + minutes;
+    if (day != SCHED_EVERY_DAY) {
+        return insert((day * SCHED_DAY_MIN) + day_min, zone_mask);
+    }
+    for (int d = 0; d < 7; d++) {
+        int result = insert((d * SCHED_DAY_MIN) + day_min, zone_mask);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+int Schedule::remove(uint8_t index) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (index >= _count) {
+        return -1;
+    }
+    for (int i = index; i < _count - 1; i++) {
+        _slots[i] = _slots[i + 1];
+    }
+    _count--;
+    return 0;
+}
+
+void Schedule::clear(void) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    _count = 0;
+}
+
+sched_slot_t Schedule::slot(uint8_t index) const {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    return _slots[index];
+}
+
+int Schedule::load(const sched_slot_t *slots, uint8_t count) {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    _count = 0;
+    if (count > SCHED_MAX_SLOTS) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if ((slots[i].week_min >= SCHED_WEEK_MIN) || (slots[i].zone_mask == 0) ||
+            ((i > 0) && (slots[i].week_min <= slots[i - 1].week_min))) {
+            return -1;
+        }
+    }
+    memcpy(_slots, slots, count * sizeof(sched_slot_t));
+    _count = count;
+    return 0;
+}
+
+void Schedule::store(sched_slot_t slots[SCHED_MAX_SLOTS], uint8_t *p_count) const {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    memset(slots, 0, SCHED_MAX_SLOTS * sizeof(sched_slot_t));
+    memcpy(slots, _slots, _count * sizeof(sched_slot_t));
+    *p_count = _count;
+}
+
+/**********************************************************************
+* Function: find_next
+* Parameters: now_epoch - current RTC time
+*             p_event - filled with the first event after now
+* Returns: false when there is no slot
+*
+* Description: upper bound binary search on the minute of the week,
+* past the last slot it wraps to the first one of the next week
+**********************************************************************/
+bool Schedule::find_next(uint32_t now_epoch, sched_event_t *p_event) const {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (_count == 0) {
+        return false;
+    }
+
+    uint32_t week_s = (weekday(now_epoch) * 86400) + (now_epoch % 86400);
+    uint32_t week_start = now_epoch - week_s;
+    uint16_t now_min = week_s / 60;
+
+    // first slot with week_min * 60 > week_s
+    uint8_t lo = 0;
+    uint8_t hi = _count;
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        if (_slots[mid].week_min <= now_min) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == _count) {
+        lo = 0;
+        week_start += SCHED_WEEK_S;
+    }
+
+    p_event->index = lo;
+    p_event->zone_mask = _slots[lo].zone_mask;
+    p_event->epoch = week_start + ((uint32_t)_slots[lo].week_min * 60);
+    return true;
+}
+
+bool Schedule::advance(sched_event_t *p_event) const {
+    ScopedLock<PlatformMutex> lock(_mutex);
+
+    if (p_event->index >= _count) {
+        return false;
+    }
+
+    uint8_t next = (p_event->index + 1) % _count;
+    int32_t delta_min = (int32_t)_slots[next].week_min - _slots[p_event->index].week_min;
+    if (next <= p_event->index) {
+        delta_min += SCHED_WEEK_MIN;
+    }
+
+    p_event->index = next;
+    p_event->zone_mask = _slots[next].zone_mask;
+    p_event->epoch += delta_min * 60;
+    return true;
+}
+
+/**********************************************************************
+* Function: insert
+* Parameters: week_min, zone_mask - new slot
+* Returns: 0 on success, -2 table full
+*
+* Description: keeps the table sorted, a slot at an existing minute
+* only adds its zones to it
+**********************************************************************/
+int Schedule::insert(uint16_t week_min, uint8_t zone_mask) {
+    int pos = 0;
+
+    while ((pos < _count) && (_slots[pos].week_min < week_min)) {
+        pos++;
+    }
+    if ((pos < _count) && (_slots[pos].week_min == week_min)) {
+        _slots[pos].zone_mask |= zone_mask;
+        return 0;
+    }
+    if (_count >= SCHED_MAX_SLOTS) {
+        return -2;
+    }
+    for (int i = _count; i > pos; i--) {
+        _slots[i] = _slots[i - 1];
+    }
+    _slots[pos].week_min = week_min;
+    _slots[pos].zone_mask = zone_mask;
+    _slots[pos].reserved = 0;
+    _count++;
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#include "mbed.h"
+#include "platform/PlatformMutex.h"
+#include <cstdint>
+
+#include "main_types.h"
+
+// room for 4 starts a day on every day of the week
+#define SCHED_MAX_SLOTS     32
+#define SCHED_DAY_MIN       (24 * 60)
+#define SCHED_WEEK_MIN      (7 * SCHED_DAY_MIN)
+#define SCHED_WEEK_S        ((uint32_t)SCHED_WEEK_MIN * 60)
+// day argument of add() for a slot on every day of the week
+#define SCHED_EVERY_DAY     7
+#define SCHED_ZONES_ALL     ((1 << ZoneCount) - 1)
+// 1970-01-01 was a Thursday
+#define SCHED_EPOCH_WEEKDAY 4
+
+/** One wattering start, minute resolution */
+typedef struct {
+    uint16_t week_min;      // minutes since Sunday 00:00
+    uint8_t  zone_mask;     // bit per e_ZONE
+    uint8_t  reserved;
+} sched_slot_t;
+
+/** A slot resolved to an absolute time */
+typedef struct {
+    uint32_t epoch;
+    uint8_t  zone_mask;
+    uint8_t  index;         // slot in the table, for advance()
+} sched_event_t;
+
+/** Weekly wattering schedule
+ *
+ * Slots live in a table sorted by minute of the week, one entry per minute
+ * (adding a slot at an existing minute merges the zone masks). The caller
+ * keeps the upcoming event and compares it with the clock, O(1) per tick:
+ * - find_next() binary searches the table, needed at boot and whenever the
+ *   table or the clock changed
+ * - advance() steps to the following slot once an event was served, O(1)
+ * Days are 0 = Sunday .. 6 = Saturday, times are RTC (local) time.
+ * The table is guarded by a PlatformMutex. A kept event refers to a table
+ * index, so edits and advance() belong in one context (main.cpp: control).
+ *
+ * @code
+ * Schedule schedule;
+ * sched_event_t next;
+ *
+ * schedule.add(SCHED_EVERY_DAY, 8, 0, SCHED_ZONES_ALL);
+ * schedule.find_next(rtc.get_epoch(), &next);
+ * // every tick
+ * if (now >= next.epoch) {
+ *     water(next.zone_mask);
+ *     schedule.advance(&next);
+ * }
+ * @endcode
+ */
+class Schedule {
+public:
+    Schedule();
+
+    /** Insert a slot, keeps the table sorted
+     *
+     * @param day        0..6, SCHED_EVERY_DAY adds one slot per day
+     * @returns 0 on success, -1 bad argument, -2 table full (with SCHED_EVERY_DAY
+     *          the days that still fitted stay in)
+     */
+    int add(uint8_t day, uint8_t hours, uint8_t minutes, uint8_t zone_mask);
+
+    /** @returns 0 on success, -1 no such slot */
+    int remove(uint8_t index);
+
+    void clear(void);
+
+    uint8_t count(void) const { return _count; }
+
+    /** Copy of a table entry, index < count() */
+    sched_slot_t slot(uint8_t index) const;
+
+    /** Replace the table, e.g. from the stored config
+     *
+     * @returns 0 on success, -1 when the entries are not sorted/valid (table left empty)
+     */
+    int load(const sched_slot_t *slots, uint8_t count);
+
+    /** Copy the table out, unused entries are zeroed */
+    void store(sched_slot_t slots[SCHED_MAX_SLOTS], uint8_t *p_count) const;
+
+    /** First event strictly after now_epoch, O(log n)
+     *
+     * @returns false when the table is empty
+     */
+    bool find_next(uint32_t now_epoch, sched_event_t *p_event) const;
+
+    /** Replace an event by the one following it, O(1)
+     *
+     * @returns false when the table is empty or the event index is out of range
+     */
+    bool advance(sched_event_t *p_event) const;
+
+    /** Day of the week (0 = Sunday) of an epoch */
+    static uint8_t weekday(uint32_t epoch) { return ((epoch / 86400) + SCHED_EPOCH_WEEKDAY) % 7; }
+
+private:
+    int insert(uint16_t week_min, uint8_t zone_mask);
+
+    mutable PlatformMutex _mutex;
+    sched_slot_t _slots[SCHED_MAX_SLOTS];
+    uint8_t _count;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: temp_stats.cpp
+ *
+ * __Description:__
+ * rolling temperature min/max/mean and degree-hours, see temp_stats.h
+ *******************************************************************************/
+
+#include "temp_stats.h"
+
+#define TEMP_STATS_PERIOD_MS    ((uint32_t)TEMP_STATS_PERIOD_S * 1000)
+
+TempStats::TempStats() :
+    _head(0), _count(0), _sum(0),
+    _min_first(0), _min_len(0), _max_first(0), _max_len(0),
+    _acc_sum(0), _acc_n(0), _acc_start_ms(0),
+    _dh_q_s(0), _dh_period_s(0), _cycle_seen(false)
+{
+}
+
+void TempStats::sample(temp_q_t temp_q, uint32_t now_ms) {
+    if (_acc_n == 0) {
+        _acc_start_ms = now_ms;
+    }
+    _acc_sum += temp_q;
+    _acc_n++;
+
+    uint32_t elapsed_ms = now_ms - _acc_start_ms;
+    if (elapsed_ms < TEMP_STATS_PERIOD_MS) {
+        return;
+    }
+
+    temp_q_t period_mean = _acc_sum / _acc_n;
+    uint32_t period_s = elapsed_ms / 1000;
+    _acc_sum = 0;
+    _acc_n = 0;
+
+    push(period_mean);
+
+    if (period_mean > TEMP_STATS_BASE_Q) {
+        uint32_t heat = (uint32_t)(period_mean - TEMP_STATS_BASE_Q) * period_s;
+        _dh_q_s = (_dh_q_s > UINT32_MAX - heat) ? UINT32_MAX : _dh_q_s + heat;
+    }
+    _dh_period_s += period_s;
+}
+
+void TempStats::cycle_start(void) {
+    _dh_q_s = 0;
+    _dh_period_s = 0;
+    _cycle_seen = true;
+}
+
+temp_q_t TempStats::min(void) const {
+    return (_min_len > 0) ? _ring[_min_dq[_min_first]] : 0;
+}
+
+temp_q_t TempStats::max(void) const {
+    return (_max_len > 0) ? _ring[_max_dq[_max_first]] : 0;
+}
+
+temp_q_t TempStats::mean(void) const {
+    return (_count > 0) ? (_sum / _count) : 0;
+}
+
+/**********************************************************************
+* Function: push
+* Parameters: temp_q - new window sample
+* Returns: --
+*
+* Description: O(1) amortized, every ring index enters and leaves each
+* deque at most once
+**********************************************************************/
+void TempStats::push(temp_q_t temp_q) {
+    if (_count == TEMP_STATS_WINDOW) {
+        // the oldest sample drops out, if still in a deque it is the front
+        _sum -= _ring[_head];
+        if ((_min_len > 0) && (_min_dq[_min_first] == _head)) {
+            _min_first = (_min_first + 1) % TEMP_STATS_WINDOW;
+            _min_len--;
+        }
+        if ((_max_len > 0) && (_max_dq[_max_first] == _head)) {
+            _max_first = (_max_first + 1) % TEMP_STATS_WINDOW;
+            _max_len--;
+        }
+    } else {
+        _count++;
+    }
+    _ring[_head] = temp_q;
+    _sum += temp_q;
+
+    // older samples that can never be the extreme again
+    while ((_min_len > 0) && (_ring[_min_dq[(_min_first + _min_len - 1) % TEMP_STATS_WINDOW]] >= temp_q)) {
+        _min_len--;
+    }
+    _min_dq[(_min_first + _min_len) % TEMP_STATS_WINDOW] = _head;
+    _min_len++;
+
+    while ((_max_len > 0) && (_ring[_max_dq[(_max_first + _max_len - 1) % TEMP_STATS_WINDOW]] <= temp_q)) {
+        _max_len--;
+    }
+    _max_dq[(_max_first + _max_len) % TEMP_STATS_WINDOW] = _head;
+    _max_len++;
+
+    _head = (_head + 1) % TEMP_STATS_WINDOW;
+}
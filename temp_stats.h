@@ -0,0 +1,89 @@
+#ifndef __TEMP_STATS_H__
+#define __TEMP_STATS_H__
+
+#include <cstdint>
+
+#include "main_types.h"
+
+// one window sample = mean of the heartbeat readings over this period
+#define TEMP_STATS_PERIOD_S     300
+// 24h window of 5 min means
+#define TEMP_STATS_WINDOW       288
+// degree-hours count the heat above this temperature
+#define TEMP_STATS_BASE_Q       TEMP_C_TO_Q(20)
+
+/** Rolling temperature statistics in constant memory
+ *
+ * Heartbeat readings are averaged into one sample per TEMP_STATS_PERIOD_S.
+ * The last TEMP_STATS_WINDOW samples sit in a ring, every statistic is
+ * updated in O(1) (amortized for min/max) when a sample enters:
+ * - mean from a running sum
+ * - min/max from monotonic deques of ring indexes, the front is the
+ *   extreme, entries dominated by a newer sample are dropped from the back
+ * - degree-hours above TEMP_STATS_BASE_Q since cycle_start()
+ *
+ * @code
+ * TempStats temp_stats;
+ *
+ * temp_stats.sample(rtcTempQ, HAL_GetTick());     // every heartbeat
+ * if (temp_stats.valid()) {
+ *     printf("max " TEMP_Q_FMT "\r\n", TEMP_Q_ARGS(temp_stats.max()));
+ * }
+ * @endcode
+ */
+class TempStats {
+public:
+    TempStats();
+
+    /** Add one reading, expected about once per second */
+    void sample(temp_q_t temp_q, uint32_t now_ms);
+
+    /** Restart the degree-hours, call when a wattering cycle starts */
+    void cycle_start(void);
+
+    /** true once the window holds at least one sample */
+    bool valid(void) const { return _count > 0; }
+
+    /** Samples in the window, TEMP_STATS_WINDOW when full */
+    uint16_t count(void) const { return _count; }
+
+    temp_q_t min(void) const;
+    temp_q_t max(void) const;
+    temp_q_t mean(void) const;
+
+    /** Heat above TEMP_STATS_BASE_Q since cycle_start() (or boot), 1/4 degC * s */
+    uint32_t degree_q_s(void) const { return _dh_q_s; }
+
+    /** Time covered by degree_q_s() */
+    uint32_t degree_period_s(void) const { return _dh_period_s; }
+
+    /** false until the first cycle_start(), degree-hours only cover the time since boot */
+    bool cycle_seen(void) const { return _cycle_seen; }
+
+private:
+    void push(temp_q_t temp_q);
+
+    temp_q_t _ring[TEMP_STATS_WINDOW];
+    uint16_t _head;             // next slot, the oldest sample once the ring is full
+    uint16_t _count;
+    int32_t _sum;
+
+    // monotonic deques, ring indexes oldest first
+    uint16_t _min_dq[TEMP_STATS_WINDOW];
+    uint16_t _min_first;
+    uint16_t _min_len;
+    uint16_t _max_dq[TEMP_STATS_WINDOW];
+    uint16_t _max_first;
+    uint16_t _max_len;
+
+    // current period
+    int32_t _acc_sum;
+    uint16_t _acc_n;
+    uint32_t _acc_start_ms;
+
+    uint32_t _dh_q_s;
+    uint32_t _dh_period_s;
+    bool _cycle_seen;
+};
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ *******************************************************************************
+ * Project:		arm-of-suijin
+ * File: tools/bus_sim/bus_sim.cpp
+ *
+ * __Description:__
+ * host (Linux) simulation of several controllers on the shared pump bus
+ * - hub:   creates N pseudo-terminals and copies every byte written by one
+ *          node to all the others, like a multi-drop RS-485 line
+ * - node:  runs PumpBus on one of the pty's, all nodes trigger a wattering
+ *          cycle at the same wall clock second, like set_next_time() does
+ * - demo:  hub + N nodes forked from one process, Ctrl-C stops all of them
+ * - collide: two nodes on an in-memory line with a simulated clock, frames
+ *          sent in the same 10ms tick garble each other; checks that the
+ *          slot is never granted to both, for simultaneous claims and for
+ *          a claim while the pumping holder was not heard
+ *
+ * build: g++ -std=c++14 -I../.. bus_sim.cpp ../../pump_bus.cpp -o bus_sim
+ * run:   ./bus_sim demo 3 20 5        (3 nodes, cycle every 20s, 5s of pumping)
+ *        ./bus_sim collide            (exit code 0 = pass)
+ *******************************************************************************/
+
+#include "pump_bus.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SIM_MAX_NODES 8
+#define SIM_TICK_MS 10
+#define SIM_LINE_SIZE 256
+
+static volatile sig_atomic_t sim_stop = 0;
+
+static void sim_signal(int sig) {
+    sim_stop = 1;
+}
+
+// no SA_RESTART, a blocked poll() returns on the signal
+static void sim_catch_signals(void) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sim_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+static uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+static void set_raw(int fd) {
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+class PtyPort : public PumpBusPort {
+public:
+    explicit PtyPort(int fd) : _fd(fd) {}
+
+    virtual int read(uint8_t *buf, size_t len) {
+        ssize_t n = ::read(_fd, buf, len);
+        return (n > 0) ? (int)n : 0;
+    }
+
+    virtual void write(const uint8_t *buf, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(_fd, buf, len);
+            if (n <= 0) {
+                return;
+            }
+            buf += n;
+            len -= n;
+        }
+    }
+
+private:
+    int _fd;
+};
+
+/**********************************************************************
+* Function: hub_open
+* Parameters: n - number of nodes, masters/slaves - pty names out
+* Returns: 0 ok
+*
+* Description: opens n pty pairs, slaves are kept open in raw mode so
+* the line discipline neither echoes nor translates the frames
+**********************************************************************/
+static int hub_open(int n, int *masters, char names[][64]) {
+    for (int i = 0; i < n; i++) {
+        masters[i] = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((masters[i] < 0) || grantpt(masters[i]) || unlockpt(masters[i])) {
+            perror("pty");
+            return -1;
+        }
+        snprintf(names[i], 64, "%s", ptsname(masters[i]));
+        int slave = open(names[i], O_RDWR | O_NOCTTY);
+        if (slave < 0) {
+            perror(names[i]);
+            return -1;
+        }
+        set_raw(slave);
+    }
+    return 0;
+}
+
+static void hub_run(int n, int *masters) {
+    struct pollfd fds[SIM_MAX_NODES];
+    uint8_t buf[64];
+
+    for (int i = 0; i < n; i++) {
+        fds[i].fd = masters[i];
+        fds[i].events = POLLIN;
+    }
+    while (!sim_stop) {
+        if (poll(fds, n, -1) < 0) {
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t len = read(masters[i], buf, sizeof(buf));
+            for (int j = 0; (len > 0) && (j < n); j++) {
+                if (j != i) {
+                    write(masters[j], buf, len);
+                }
+            }
+        }
+    }
+}
+
+static void node_run(int id, const char *pty, int period_s, int water_s) {
+    int fd = open(pty, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        perror(pty);
+        exit(1);
+    }
+    set_raw(fd);
+
+    PtyPort port(fd);
+    PumpBus bus(&port, id);
+    time_t last_trigger = 0;
+    uint32_t water_end = 0;
+    bool watering = false;
+
+    printf("node %d: on %s\n", id, pty);
+    fflush(stdout);
+    while (!sim_stop) {
+        uint32_t now = now_ms();
+        time_t wall = time(NULL);
+
+        bus.poll(now);
+
+        // every node fires at the same wall clock second
+        if (((wall % period_s) == 0) && (wall != last_trigger)) {
+            last_trigger = wall;
+            printf("%ld node %d: trigger, waiting for slot\n", (long)(wall % 1000), id);
+            bus.request(now);
+        }
+        if (!watering && bus.granted()) {
+            watering = true;
+            water_end = now + (water_s * 1000);
+            printf("%ld node %d: slot granted, pumps ON\n", (long)(wall % 1000), id);
+        }
+        if (watering && ((int32_t)(now - water_end) >= 0)) {
+            watering = false;
+            bus.release(now);
+            printf("%ld node %d: pumps OFF, slot released\n", (long)(wall % 1000), id);
+        }
+        fflush(stdout);
+        usleep(5000);
+    }
+    bus.release(now_ms());
+    close(fd);
+}
+
+/** One node's end of the in-memory line */
+class MemPort : public PumpBusPort {
+public:
+    MemPort() : _rx_len(0), _tx_len(0) {}
+
+    virtual int read(uint8_t *buf, size_t len) {
+        size_t n = (len < _rx_len) ? len : _rx_len;
+        memcpy(buf, _rx, n);
+        memmove(_rx, _rx + n, _rx_len - n);
+        _rx_len -= n;
+        return (int)n;
+    }
+
+    virtual void write(const uint8_t *buf, size_t len) {
+        if (_tx_len + len <= sizeof(_tx)) {
+            memcpy(_tx + _tx_len, buf, len);
+            _tx_len += len;
+        }
+    }
+
+    void deliver(const uint8_t *buf, size_t len) {
+        if (_rx_len + len <= sizeof(_rx)) {
+            memcpy(_rx + _rx_len, buf, len);
+            _rx_len += len;
+        }
+    }
+
+    uint8_t _rx[SIM_LINE_SIZE];
+    size_t _rx_len;
+    uint8_t _tx[SIM_LINE_SIZE];
+    size_t _tx_len;
+};
+
+/**********************************************************************
+* Function: collide_case
+* Parameters: name - printed with the result
+*             req_ms - request time of node 1 and node 2
+*             mute_from, mute_to - frames of node 2 do not reach node 1
+*             first - node expected to get the slot first
+* Returns: 0 pass, 1 fail
+*
+* Description: frames sent by both nodes in the same tick garble each
+* other (every byte inverted). Each node waters for 5s once granted. The
+* slot must never be granted twice nor taken away while pumping, the
+* expected node gets it first and the other one after the release and
+* the gap.
+**********************************************************************/
+static int collide_case(const char *name, const uint32_t req_ms[2], uint32_t mute_from, uint32_t mute_to, int first) {
+    MemPort ports[2];
+    PumpBus nodes[2] = { PumpBus(&ports[0], 1), PumpBus(&ports[1], 2) };
+    int collisions = 0;
+    uint32_t granted_ms[2] = { 0, 0 };
+    bool pumping[2] = { false, false };
+
+    printf("-- %s\n", name);
+    for (uint32_t now = 0; now < 30000; now += SIM_TICK_MS) {
+        // frames of the previous tick, garbled when both nodes talked
+        bool collision = (ports[0]._tx_len > 0) && (ports[1]._tx_len > 0);
+        bool mute = (now >= mute_from) && (now < mute_to);
+        collisions += collision ? 1 : 0;
+        for (int i = 0; i < 2; i++) {
+            for (size_t k = 0; collision && (k < ports[i]._tx_len); k++) {
+                ports[i]._tx[k] ^= 0xFF;
+            }
+            if (!mute || (i == 0)) {
+                ports[1 - i].deliver(ports[i]._tx, ports[i]._tx_len);
+            }
+            ports[i]._tx_len = 0;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            if (now == req_ms[i]) {
+                nodes[i].request(now);
+            }
+            nodes[i].poll(now);
+            if (pumping[i] && !nodes[i].granted()) {
+                printf("%5lu FAIL: node %d lost the slot while pumping\n", (unsigned long)now, i + 1);
+                return 1;
+            }
+            if (nodes[i].granted() && (granted_ms[i] == 0)) {
+                granted_ms[i] = now;
+                pumping[i] = true;
+                printf("%5lu node %d: slot granted\n", (unsigned long)now, i + 1);
+            }
+            if (pumping[i] && (now - granted_ms[i] == 5000)) {
+                nodes[i].release(now);
+                pumping[i] = false;
+                printf("%5lu node %d: released\n", (unsigned long)now, i + 1);
+            }
+        }
+        if (nodes[0].granted() && nodes[1].granted()) {
+            printf("%5lu FAIL: both nodes granted\n", (unsigned long)now);
+            return 1;
+        }
+    }
+
+    int second = 3 - first;
+    printf("%d collided ticks\n", collisions);
+    if ((granted_ms[first - 1] == 0) || (granted_ms[second - 1] <= granted_ms[first - 1])) {
+        printf("FAIL: expected node %d then node %d\n", first, second);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
+
+/**********************************************************************
+* Function: collide_run
+* Parameters: --
+* Returns: 0 pass, 1 fail
+*
+* Description:
+* -- both nodes request in the same tick, claims and holds collide, the
+*    lower id has to end up with the slot
+* -- node 2 is already pumping when node 1 stops hearing it for 2.8s and
+*    claims the "free" slot, the confirmed holder has to keep it
+**********************************************************************/
+static int collide_run(void) {
+    static const uint32_t same_tick[2] = { 0, 0 };
+    static const uint32_t late[2] = { 3000, 0 };
+    int result = 0;
+
+    result |= collide_case("simultaneous request", same_tick, 0, 0, 1);
+    result |= collide_case("holder unheard, late claim", late, 3000, 5800, 2);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    if ((argc >= 3) && (strcmp(argv[1], "hub") == 0)) {
+        int n = atoi(argv[2]);
+        int masters[SIM_MAX_NODES];
+        char names[SIM_MAX_NODES][64];
+
+        if ((n < 2) || (n > SIM_MAX_NODES) || hub_open(n, masters, names)) {
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            printf("%s\n", names[i]);
+        }
+        fflush(stdout);
+        sim_catch_signals();
+        hub_run(n, masters);
+        return 0;
+    }
+
+    if ((argc >= 4) && (strcmp(argv[1], "node") == 0)) {
+        sim_catch_signals();
+        node_run(atoi(argv[2]), argv[3], (argc > 4) ? atoi(argv[4]) : 20, (argc > 5) ? atoi(argv[5]) : 5);
+        return 0;
+    }
+
+    if ((argc >= 2) && (strcmp(argv[1], "collide") == 0)) {
+        return collide_run();
+    }
+
+    if ((argc >= 3) && (strcmp(argv[1], "demo") == 0)) {
+        int n = atoi(argv[2]);
+        int period_s = (argc > 3) ? atoi(argv[3]) : 20;
+        int water_s = (argc > 4) ? atoi(argv[4]) : 5;
+        int masters[SIM_MAX_NODES];
+        char names[SIM_MAX_NODES][64];
+        pid_t pids[SIM_MAX_NODES];
+
+        if ((n < 2) || (n > SIM_MAX_NODES) || hub_open(n, masters, names)) {
+            return 1;
+        }
+        sim_catch_signals();
+        for (int i = 0; i < n; i++) {
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                node_run(i + 1, names[i], period_s, water_s);
+                exit(0);
+            }
+        }
+        hub_run(n, masters);
+        for (int i = 0; i < n; i++) {
+            kill(pids[i], SIGTERM);
+            waitpid(pids[i], NULL, 0);
+        }
+        return 0;
+    }
+
+    printf("usage: %s hub <n> | node <id> <pty> [period_s] [water_s] | demo <n> [period_s] [water_s] | collide\n",
+            argv[0]);
+    return 1;
+}